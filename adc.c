@@ -0,0 +1,602 @@
+/**** adc.c ********************************/
+/*   Universal RPi GPIO keyboard daemon    */
+/*                                         */
+/* SPI analog to digital converters        */
+/*******************************************/
+
+/*
+   This file is part of the Universal Raspberry Pi GPIO keyboard daemon.
+
+   This is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   The software is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with the GNU C Library; if not, write to the Free
+   Software Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+   02111-1307 USA.  
+*/
+
+
+/* MCP3008/MCP3208 converters on spidev.  Every converter with channels in
+ * use gets a sampling thread that reads all of them in one SPI message at
+ * a fixed rate and runs each through an IIR filter.  The thread only ever
+ * updates the current state of each channel (axis position, which voltage
+ * window is active); adc_poll() on the main loop sends whatever changed,
+ * so a slow or stuck converter can't hold up the key scan.
+ *
+ * Rapid trigger keys (Hall effect switches) are the exception: they are
+ * decided on the sampling thread from unfiltered readings and every press
+ * and release is queued with the time of the sample that crossed, so none
+ * are lost between main loop passes.  That time goes out with the key as
+ * its MSC_TIMESTAMP, and the uinput writer measures the delay to the
+ * write() for each rapid trigger key.
+ *
+ * adc_sample() takes one reading of one channel and is all the processing
+ * there is, so recorded readings can be replayed through it.  New
+ * converters only need an entry in adc_drv[].
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include "config.h"
+#include "gpio.h"
+#include "spi.h"
+#include "adc.h"
+#include "uinput.h"
+#include "keystate.h"
+#include "stream.h"
+#include "debug.h"
+
+#define ADC_XFER        3       /* bytes per channel conversion */
+
+typedef struct{
+  const char *name;
+  int bits;
+  int channels;
+  void (*cmd)(int ch, char *tx);
+  int (*value)(const char *rx);
+}adc_drv_s;
+
+typedef struct{
+  int ch;
+  int lo, hi;
+  int key;
+}adc_key_s;
+
+/* a rapid trigger key, positions are in 1/1000 of the learned travel */
+typedef struct{
+  int key;                      /* 0 when the channel has none */
+  int act, delta;
+  int rest, bottom;             /* raw readings at the top and bottom */
+  int ncal;
+  int cal_sum;
+  int pressed;
+  int ext;                      /* deepest point pressed, highest released */
+
+  /* main loop only, write delays already reported */
+  unsigned long n_seen;
+  unsigned long long sum_seen;
+}adc_rt_s;
+
+typedef struct{
+  int ch;
+  int value;
+  unsigned long long t;
+}adc_ev_s;
+
+typedef struct{
+  char *name;
+  const adc_drv_s *drv;
+  int fd;
+  int rate;
+  int chmask;
+  int hyst;
+  int y[ADC_CHANNELS];                  /* filter state, 4 fraction bits */
+  volatile int primed;                  /* channels with a first reading */
+
+  /* sampling thread to main loop */
+  volatile int value[ADC_CHANNELS];     /* filtered, with hysteresis */
+  volatile int active[ADC_CHANNELS];    /* window in keys[] or -1 */
+  volatile unsigned errors;
+
+  /* main loop only */
+  int axis[ADC_CHANNELS];
+  int sent_value[ADC_CHANNELS];
+  int sent_active[ADC_CHANNELS];
+  unsigned err_seen;
+
+  adc_key_s keys[MAX_ADC_KEYS];
+  int nkeys;
+  adc_rt_s rt[ADC_CHANNELS];
+  int rtmask;
+
+  /* rapid trigger changes, sampling thread to main loop */
+  adc_ev_s q[ADC_QUEUE];
+  volatile unsigned head, tail;
+  volatile unsigned overrun;
+  unsigned overrun_seen;
+
+  pthread_t thread;
+}adc_dev_s;
+
+static void mcp3008_cmd(int ch, char *tx);
+static int mcp3008_value(const char *rx);
+static void mcp3208_cmd(int ch, char *tx);
+static int mcp3208_value(const char *rx);
+
+static const adc_drv_s adc_drv[] = {
+  { "MCP3008", 10, 8, mcp3008_cmd, mcp3008_value },
+  { "MCP3004", 10, 4, mcp3008_cmd, mcp3008_value },
+  { "MCP3208", 12, 8, mcp3208_cmd, mcp3208_value },
+  { "MCP3204", 12, 4, mcp3208_cmd, mcp3208_value },
+  { NULL, 0, 0, NULL, NULL }
+};
+
+static adc_dev_s adc_dev[MAX_ADC_DEVS];
+static int adc_count = 0;
+
+static void *adc_thread(void *arg);
+static void adc_window(adc_dev_s *a, int ch, int v);
+static void adc_rt_sample(adc_dev_s *a, int ch, int x, unsigned long long t);
+static void adc_rt_report(void);
+
+
+/* single ended conversions: start bit, SGL and channel, then the result
+ * clocks out over the last two bytes
+ */
+static void mcp3008_cmd(int ch, char *tx) {
+
+  tx[0] = 0x01;
+  tx[1] = 0x80 | (ch << 4);
+  tx[2] = 0;
+}
+
+static int mcp3008_value(const char *rx) {
+
+  return(((rx[1] & 0x03) << 8) | (unsigned char) rx[2]);
+}
+
+static void mcp3208_cmd(int ch, char *tx) {
+
+  tx[0] = 0x06 | ((ch >> 2) & 1);
+  tx[1] = (ch & 3) << 6;
+  tx[2] = 0;
+}
+
+static int mcp3208_value(const char *rx) {
+
+  return(((rx[1] & 0x0f) << 8) | (unsigned char) rx[2]);
+}
+
+
+/* add a converter of "type" on spidev node "dev", returns its number, -1
+ * for an unknown type or -2 when the device can't be opened
+ */
+int adc_add(const char *name, const char *type, const char *dev, int rate) {
+
+  adc_dev_s *a;
+  int i;
+
+  if (adc_count >= MAX_ADC_DEVS) {
+    return(-1);
+  }
+  a = &adc_dev[adc_count];
+  memset(a, 0, sizeof(adc_dev_s));
+
+  for (i=0; adc_drv[i].name; i++) {
+    if (!strcmp(adc_drv[i].name, type)) {
+      a->drv = &adc_drv[i];
+    }
+  }
+  if (!a->drv) {
+    return(-1);
+  }
+  if ((a->fd = spi_open(dev, ADC_SPEED)) < 0) {
+    return(-2);
+  }
+
+  a->name = strdup(name);
+  a->rate = (rate > 0) ? rate : ADC_RATE;
+  a->hyst = 1 << (a->drv->bits - 8);
+  for (i=0; i<ADC_CHANNELS; i++) {
+    a->axis[i] = -1;
+    a->active[i] = -1;
+    a->sent_active[i] = -1;
+    a->sent_value[i] = -1;
+  }
+
+  return(adc_count++);
+}
+
+
+int adc_find(const char *name) {
+
+  int i;
+
+  for (i=0; i<adc_count; i++) {
+    if (!strcmp(adc_dev[i].name, name)) {
+      return(i);
+    }
+  }
+  return(-1);
+}
+
+
+/* full scale reading of converter "adc" */
+int adc_range(int adc) {
+
+  return((1 << adc_dev[adc].drv->bits) - 1);
+}
+
+
+/* channel "ch" drives absolute axis "code" */
+int adc_axis(int adc, int ch, int code) {
+
+  adc_dev_s *a = &adc_dev[adc];
+
+  if ((ch < 0) || (ch >= a->drv->channels) || (a->axis[ch] >= 0)) {
+    return(-1);
+  }
+  a->axis[ch] = code;
+  a->chmask |= 1 << ch;
+  uinput_use_abs(code, 0, adc_range(adc), a->hyst, a->hyst * 4);
+
+  return(0);
+}
+
+
+/* "key" is held while channel "ch" reads between "lo" and "hi" */
+int adc_key(int adc, int ch, int lo, int hi, int key) {
+
+  adc_dev_s *a = &adc_dev[adc];
+
+  if ((ch < 0) || (ch >= a->drv->channels) || (a->nkeys >= MAX_ADC_KEYS) ||
+      (lo > hi)) {
+    return(-1);
+  }
+  a->keys[a->nkeys].ch = ch;
+  a->keys[a->nkeys].lo = lo;
+  a->keys[a->nkeys].hi = hi;
+  a->keys[a->nkeys].key = key;
+  a->nkeys++;
+  a->chmask |= 1 << ch;
+
+  return(0);
+}
+
+
+/* "key" on channel "ch" is a rapid trigger switch: it presses "act"/1000
+ * of the way down, releases as soon as it comes back up "delta"/1000 from
+ * its deepest point and presses again on going down "delta" from its
+ * highest.  The travel is learned as the switch is used.
+ */
+int adc_rapid(int adc, int ch, int act, int delta, int key) {
+
+  adc_dev_s *a = &adc_dev[adc];
+
+  if ((ch < 0) || (ch >= a->drv->channels) || (a->rt[ch].key) ||
+      (delta <= 0) || (act <= delta) || (act > 1000)) {
+    return(-1);
+  }
+  memset(&a->rt[ch], 0, sizeof(adc_rt_s));
+  if (uinput_lat_key(key) < 0) {
+    return(-1);
+  }
+  a->rt[ch].key = key;
+  a->rt[ch].act = act;
+  a->rt[ch].delta = delta;
+  a->rtmask |= 1 << ch;
+  a->chmask |= 1 << ch;
+  if (a->rate < ADC_RT_RATE) {
+    a->rate = ADC_RT_RATE;
+  }
+
+  return(0);
+}
+
+
+/* start a sampling thread for every converter that has channels in use */
+int adc_start(void) {
+
+  int i, n = 0;
+
+  for (i=0; i<adc_count; i++) {
+    if (!adc_dev[i].chmask) {
+      continue;
+    }
+    if (pthread_create(&adc_dev[i].thread, NULL, adc_thread, &adc_dev[i])) {
+      perror("adc thread");
+      return(-1);
+    }
+    n++;
+    if (debug_on()) {
+      printf("%s: %s channels %02x at %d samples/s\n", adc_dev[i].name,
+             adc_dev[i].drv->name, adc_dev[i].chmask, adc_dev[i].rate);
+    }
+  }
+  return(n);
+}
+
+
+static void *adc_thread(void *arg) {
+
+  adc_dev_s *a = (adc_dev_s *) arg;
+  char tx[ADC_CHANNELS * ADC_XFER];
+  char rx[ADC_CHANNELS * ADC_XFER];
+  int ch[ADC_CHANNELS];
+  struct timespec next;
+  long period = 1000000000L / a->rate;
+  unsigned long long t;
+  int i, n = 0;
+
+  for (i=0; i<a->drv->channels; i++) {
+    if (a->chmask & (1 << i)) {
+      a->drv->cmd(i, &tx[n * ADC_XFER]);
+      ch[n++] = i;
+    }
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &next);
+
+  while (1) {
+    next.tv_nsec += period;
+    while (next.tv_nsec >= 1000000000L) {
+      next.tv_nsec -= 1000000000L;
+      next.tv_sec++;
+    }
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+
+    if (spi_xfer_list(a->fd, tx, rx, ADC_XFER, n) < 0) {
+      a->errors++;
+      continue;
+    }
+    t = gpio_time_us();
+
+    for (i=0; i<n; i++) {
+      adc_sample(a - adc_dev, ch[i], a->drv->value(&rx[i * ADC_XFER]), t);
+    }
+  }
+
+  return(NULL);
+}
+
+
+/* one raw reading "raw" of channel "ch" of converter "adc", taken at "t" */
+void adc_sample(int adc, int ch, int raw, unsigned long long t) {
+
+  adc_dev_s *a = &adc_dev[adc];
+  int x, v;
+
+  if (a->rtmask & (1 << ch)) {
+    adc_rt_sample(a, ch, raw, t);
+    a->primed |= 1 << ch;
+    return;
+  }
+  x = raw << 4;
+
+  /* y += (x - y) / 2^shift, the first sample just loads it */
+  if (a->primed & (1 << ch)) {
+    a->y[ch] += (x - a->y[ch]) >> ADC_IIR_SHIFT;
+  }
+  else {
+    a->y[ch] = x;
+  }
+  v = a->y[ch] >> 4;
+
+  if (abs(v - a->value[ch]) >= a->hyst) {
+    a->value[ch] = v;
+  }
+  if (a->nkeys) {
+    adc_window(a, ch, v);
+  }
+  a->primed |= 1 << ch;
+}
+
+
+/* pick the voltage window "v" is in.  The active window is widened by the
+ * hysteresis so a reading sitting on a boundary doesn't chatter.
+ */
+static void adc_window(adc_dev_s *a, int ch, int v) {
+
+  adc_key_s *k;
+  int j = a->active[ch];
+
+  if ((j >= 0) && (v >= a->keys[j].lo - a->hyst) && (v <= a->keys[j].hi + a->hyst)) {
+    return;
+  }
+
+  for (j=0; j<a->nkeys; j++) {
+    k = &a->keys[j];
+    if ((k->ch == ch) && (v >= k->lo) && (v <= k->hi)) {
+      break;
+    }
+  }
+  a->active[ch] = (j < a->nkeys) ? j : -1;
+}
+
+
+/* rapid trigger on one raw reading.  Until ADC_RT_CAL readings are in,
+ * they are averaged for the rest position.  After that the bottom is the
+ * reading furthest from rest seen so far, and a reading beyond rest the
+ * other way becomes the new rest, so the travel keeps being learned.
+ */
+static void adc_rt_sample(adc_dev_s *a, int ch, int x, unsigned long long t) {
+
+  adc_rt_s *r = &a->rt[ch];
+  int span, pos, change = -1;
+
+  if (r->ncal < ADC_RT_CAL) {
+    r->cal_sum += x;
+    if (++r->ncal == ADC_RT_CAL) {
+      r->rest = r->bottom = r->cal_sum / ADC_RT_CAL;
+    }
+    return;
+  }
+
+  if (abs(x - r->rest) > abs(r->bottom - r->rest)) {
+    r->bottom = x;
+  }
+  else if ((x - r->rest) * (r->bottom - r->rest) < 0) {
+    r->rest = x;
+  }
+
+  /* nothing to go on until the switch has moved a useful distance */
+  span = abs(r->bottom - r->rest);
+  if (span < (adc_range(a - adc_dev) + 1) / 16) {
+    return;
+  }
+  pos = abs(x - r->rest) * 1000 / span;
+
+  if (r->pressed) {
+    if (pos > r->ext) {
+      r->ext = pos;
+    }
+    if (pos <= r->ext - r->delta) {
+      r->pressed = 0;
+      r->ext = pos;
+      change = 0;
+    }
+  }
+  else {
+    if (pos < r->ext) {
+      r->ext = pos;
+    }
+    /* from the top it takes the actuation point, part way down the delta */
+    if ((pos >= r->ext + r->delta) && ((r->ext >= r->act) || (pos >= r->act))) {
+      r->pressed = 1;
+      r->ext = pos;
+      change = 1;
+    }
+  }
+
+  if (change < 0) {
+    return;
+  }
+  if (a->head - a->tail >= ADC_QUEUE) {
+    a->overrun++;
+    return;
+  }
+  a->q[a->head % ADC_QUEUE].ch = ch;
+  a->q[a->head % ADC_QUEUE].value = change;
+  a->q[a->head % ADC_QUEUE].t = t;
+  __sync_synchronize();
+  a->head++;
+}
+
+
+/* called from the main loop, send axis moves and window changes */
+void adc_poll(void) {
+
+  adc_dev_s *a;
+  adc_ev_s *ev;
+  adc_rt_s *r;
+  int i, ch, v;
+
+  for (i=0; i<adc_count; i++) {
+    a = &adc_dev[i];
+
+    /* rapid trigger changes, stamped with the sample that crossed */
+    while (a->tail != a->head) {
+      __sync_synchronize();
+      ev = &a->q[a->tail % ADC_QUEUE];
+      r = &a->rt[ev->ch];
+      uinput_stamp(ev->t);
+      keystate_set(r->key, ev->value, ev->t);
+      stream_event(STREAM_KEY, STREAM_ADC, i, ev->ch, r->key, ev->value, ev->value, ev->t);
+      sendKey(r->key, ev->value);
+      a->tail++;
+    }
+    if ((a->overrun != a->overrun_seen) && debug_on()) {
+      printf("%s: %u rapid trigger changes dropped\n", a->name, a->overrun - a->overrun_seen);
+      a->overrun_seen = a->overrun;
+    }
+
+    if (!a->primed) {
+      continue;
+    }
+
+    /* filtered values aren't tied to one sample */
+    uinput_stamp(0);
+
+    for (ch=0; ch<ADC_CHANNELS; ch++) {
+      if (!(a->primed & (1 << ch))) {
+        continue;
+      }
+      if ((a->axis[ch] >= 0) && ((v = a->value[ch]) != a->sent_value[ch])) {
+        sendAbs(a->axis[ch], v);
+        a->sent_value[ch] = v;
+      }
+      if ((v = a->active[ch]) != a->sent_active[ch]) {
+        if (a->sent_active[ch] >= 0) {
+          keystate_set(a->keys[a->sent_active[ch]].key, 0, gpio_time_us());
+          stream_event(STREAM_KEY, STREAM_ADC, i, ch, a->keys[a->sent_active[ch]].key,
+                       0, 0, gpio_time_us());
+          sendKey(a->keys[a->sent_active[ch]].key, 0);
+        }
+        if (v >= 0) {
+          keystate_set(a->keys[v].key, 1, gpio_time_us());
+          stream_event(STREAM_KEY, STREAM_ADC, i, ch, a->keys[v].key, 1, 1, gpio_time_us());
+          sendKey(a->keys[v].key, 1);
+        }
+        a->sent_active[ch] = v;
+      }
+    }
+
+    if ((a->errors != a->err_seen) && debug_on()) {
+      printf("%s: %u SPI errors\n", a->name, a->errors - a->err_seen);
+      a->err_seen = a->errors;
+    }
+  }
+
+  adc_rt_report();
+}
+
+
+/* with -D, rapid trigger latency from the crossing sample to the uinput
+ * write, as measured by the writer, for every key written since the last
+ * report
+ */
+static void adc_rt_report(void) {
+
+  static unsigned long long t_report = 0;
+  unsigned long long now, sum;
+  unsigned long n;
+  unsigned max;
+  adc_rt_s *r;
+  int i, ch;
+
+  if (!debug_on()) {
+    return;
+  }
+  now = gpio_time_us();
+  if (now - t_report < ADC_LAT_REPORT * 1000000ULL) {
+    return;
+  }
+  t_report = now;
+
+  for (i=0; i<adc_count; i++) {
+    for (ch=0; ch<ADC_CHANNELS; ch++) {
+      r = &adc_dev[i].rt[ch];
+      if (!r->key || (uinput_key_latency(r->key, &n, &sum, &max) < 0) ||
+          (n == r->n_seen)) {
+        continue;
+      }
+      printf("%s:%d: %lu changes, latency avg %lluus max %uus, travel %d-%d\n",
+             adc_dev[i].name, ch, n - r->n_seen, (sum - r->sum_seen) / (n - r->n_seen),
+             max, r->rest, r->bottom);
+      r->n_seen = n;
+      r->sum_seen = sum;
+    }
+  }
+}
@@ -0,0 +1,51 @@
+/**** adc.h ********************************/
+/*   Universal RPi GPIO keyboard daemon    */
+/*                                         */
+/* SPI analog to digital converters        */
+/*******************************************/
+
+/*
+   This file is part of the Universal Raspberry Pi GPIO keyboard daemon.
+
+   This is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   The software is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with the GNU C Library; if not, write to the Free
+   Software Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+   02111-1307 USA.  
+*/
+
+
+#ifndef _ADC_H_
+#define _ADC_H_
+
+#define MAX_ADC_DEVS    4
+#define ADC_CHANNELS    8
+#define MAX_ADC_KEYS    32      /* voltage windows per converter */
+#define ADC_RATE        200     /* default samples per second */
+#define ADC_SPEED       1000000 /* MCP3x08 at 3.3V */
+#define ADC_IIR_SHIFT   2       /* filter weight of a new sample, 1/4 */
+#define ADC_RT_RATE     1000    /* minimum rate with rapid trigger keys */
+#define ADC_RT_CAL      32      /* samples averaged for the rest position */
+#define ADC_QUEUE       64      /* rapid trigger changes for the main loop */
+#define ADC_LAT_REPORT  10      /* seconds between latency reports (-D) */
+
+int adc_add(const char *name, const char *type, const char *dev, int rate);
+int adc_find(const char *name);
+int adc_range(int adc);
+int adc_axis(int adc, int ch, int code);
+int adc_key(int adc, int ch, int lo, int hi, int key);
+int adc_rapid(int adc, int ch, int act, int delta, int key);
+int adc_start(void);
+void adc_sample(int adc, int ch, int raw, unsigned long long t);
+void adc_poll(void);
+
+#endif
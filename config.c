@@ -31,43 +31,31 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <linux/input.h>
 
 #include "config.h"
 #include "iic.h"
+#include "xio.h"
 #include "gpio.h"
+#include "encoder.h"
+#include "ir.h"
+#include "ps2.h"
+#include "adc.h"
+#include "counter.h"
+#include "mouse.h"
+#include "macro.h"
+#include "keystate.h"
+#include "stream.h"
+#include "uinput.h"
 #include "debug.h"
 
 #define NUM_P1_PINS 26
 #define NUM_P5_PINS 8
 #define MAX_LN 128
-#define MAX_XIO_DEVS 8
-#define MAX_XIO_PINS 8
 
 extern key_names_s key_names[];
 
-/* each I/O expander can have 8 pins */
-typedef struct{
-  char *name;
-  iodev_e type;
-  int addr;
-  int regno;
-  int inmask;
-  int lastvalue;
-  gpio_key_s *last_key;
-  gpio_key_s *key[8];
-}xio_dev_s;
-
-<<<<<<< HEAD
-static int load_buffer(int fd);
-static char *next_token(int fd);
-static int next_command(int fd, char ***cmd);
-static void parse_err(char *str);
-static int find_key(const char *name);
-static void add_event(gpio_key_s **ev, int gpio, int key, int xio);
-static gpio_key_s *get_event(gpio_key_s *ev, int idx);
-static int find_xio(const char *name);
-static void setup_xio(int xio);
-=======
+
 int load_buffer(int fd);
 char *next_token(int fd);
 int next_command(int fd, char ***cmd);
@@ -82,7 +70,6 @@ gpio_key_s *get_event(gpio_key_s *ev, int idx);
 int find_xio(const char *name);
 void setup_xio(int xio);
 int find_mat(char *name);
->>>>>>> key_matrix
 
 static int gpios[NUM_GPIO];
 static xio_dev_s xio_dev[MAX_XIO_DEVS];
@@ -94,21 +81,15 @@ static int mat_cnt = 0;
 static int SP;
 static keyinfo_s KI;
 
-<<<<<<< HEAD
-=======
+/* hardware plan built while parsing, pins to pull for each PUD_ mode */
+static int pull_plan[3];
+
 /* config file parsing variables */
->>>>>>> key_matrix
 static char *parse_buf = (char *) 0;
 static char *parse_bufptr = (char *) 0;
 static char parse_filename[80];
 static int parse_lnno = 0;
 
-<<<<<<< HEAD
-int init_config(void)
-{
-  int i, j, k, n;
-  int fd;
-=======
 
 /* init_config() should be called once to read configuration from file.
  * The GPIO will also be configured as part of this process and should
@@ -119,25 +100,25 @@ int init_config(void) {
   int i, j, k, n;
   int fd;
   int grp_id, xio;
->>>>>>> key_matrix
   char *end_ptr;
   char **cmd;
   int tok_cnt;
   char xname[32];
+  char bus_name[32];
+  const xio_drv_s *drv;
   int gpio, caddr, regno;
   char err_str[80];
+  unsigned long long t_start, t_parse, t_pull, t_xio;
+  int pulls = 0;
+
+  t_start = gpio_time_us();
+  memset(pull_plan, 0, sizeof(pull_plan));
 
-<<<<<<< HEAD
-  for(i=0;i<NUM_GPIO;i++){
-    gpio_key[i] = NULL;
-  }
-=======
   /* initalise default matrix group for direct I/O */
   mat_grp = (mat_grp_s *) malloc(sizeof(mat_grp_s));
   memset((void *) mat_grp, 0, sizeof(mat_grp_s));
   mat_cnt = 0;
   mat_grp[0].gpio = -1;
->>>>>>> key_matrix
 
   /* search for conf file: ./pikeyd.conf, ~/.pikeyd.conf, /etc/pikeyd.conf */
   strcpy(parse_filename, "./pikeyd.conf");
@@ -158,21 +139,7 @@ int init_config(void) {
   printf("Config file is %s\n", parse_filename);
   load_buffer(fd);
 
-<<<<<<< HEAD
-  /*
-  while ((tok_cnt = next_command(fd, &cmd)) >= 0) {
-    int i;
-    if (tok_cnt) {
-      for(i=0;i<tok_cnt;i++) printf("%s[%s]",(i?",":"tok:"),(char *) cmd[i]);
-      printf("\n");
-    }
-  }
-  return(0);
-  */
-
-=======
   /* process the configuration file */
->>>>>>> key_matrix
   while ((tok_cnt = next_command(fd, &cmd)) >= 0) {
 
     /* skip blank lines */
@@ -180,73 +147,172 @@ int init_config(void) {
       continue;
     }
 
-<<<<<<< HEAD
-    /* KEY declaration */
-=======
     /**
-     ** KEY_ declaration
-     ** ===============
+     ** KEY_ on an IR remote button
+     ** ===========================
      **/
->>>>>>> key_matrix
-    if (strncmp(cmd[0], "KEY", 3) == 0) {
+    if ((strncmp(cmd[0], "KEY", 3) == 0) && (tok_cnt == 2) &&
+        (strncmp(cmd[1], "IR", 2) == 0)) {
 
-      /* verify our syntax */
-      if (tok_cnt != 2) {
-        sprintf(err_str, "\'KEY\' definition requires 1 value. (%d given)", tok_cnt-1);
+      char ir_name[32], proto_str[8];
+      int ir, proto, addr, code;
+
+      if ((k = find_key(cmd[0])) == 0) {
+        sprintf(err_str, "Unknown KEY value (%s)", cmd[0]);
+        parse_err(err_str);
+        return(0);
+      }
+      uinput_use_key(key_names[k].code);
+      if (sscanf(cmd[1], "%31[^:]:%7[^/]/%i/%i", ir_name, proto_str, &addr, &code) != 4) {
+        sprintf(err_str, "Invalid IR button definition: %s", cmd[1]);
+        parse_err(err_str);
+        return(0);
+      }
+      if ((ir = ir_find(ir_name)) < 0) {
+        sprintf(err_str, "Unknown IR receiver: %s", ir_name);
+        parse_err(err_str);
+        return(0);
+      }
+      if ((proto = ir_find_proto(proto_str)) < 0) {
+        sprintf(err_str, "Unknown IR protocol: %s", proto_str);
+        parse_err(err_str);
+        return(0);
+      }
+      if (ir_map(ir, proto, addr, code, key_names[k].code) < 0) {
+        sprintf(err_str, "Too many buttons on %s", ir_name);
         parse_err(err_str);
         return(0);
       }
+    }
+
+    /**
+     ** KEY_ on an ADC voltage window (resistor ladder keypads)
+     ** =======================================================
+     **/
+    else if ((strncmp(cmd[0], "KEY", 3) == 0) && (tok_cnt == 2) &&
+             (strncmp(cmd[1], "ADC", 3) == 0)) {
+
+      char adc_name[32];
+      int adc, ch, lo, hi;
 
-      /* check it is a known KEY */
       if ((k = find_key(cmd[0])) == 0) {
         sprintf(err_str, "Unknown KEY value (%s)", cmd[0]);
         parse_err(err_str);
         return(0);
       }
-
-<<<<<<< HEAD
-      /* test for I/O Expander definition */
-      if (strncmp(cmd[1], "XIO", 3) == 0) {
-        if (sscanf(cmd[1], "%[^:]:%i", xname, &gpio) == 2) {
-          //printf("%d XIO event %s at (%s):%d\n", lnno, name, xname, gpio);
-          if( (n = find_xio(xname)) >= 0 ){
-            k = find_key(cmd[0]);
-            if(k){
-              add_event(&xio_dev[n].key[gpio], gpio, key_names[k].code, -1);
-              //printf(" Added event %s on %s:%d\n", name, xname, gpio);
-            }
-          }
-          else {
-            sprintf(err_str, "Unknown expander: %s", xname);
-            parse_err(err_str);
-            return(0);
-          }
+      uinput_use_key(key_names[k].code);
+      /* a rapid trigger switch, actuation and delta in percent of travel */
+      if (sscanf(cmd[1], "%31[^:]:%i/RAPID/%i/%i", adc_name, &ch, &lo, &hi) == 4) {
+        if ((adc = adc_find(adc_name)) < 0) {
+          sprintf(err_str, "Unknown ADC: %s", adc_name);
+          parse_err(err_str);
+          return(0);
         }
-        else {
-          sprintf(err_str, "Invalid expander definition: %s", cmd[1]);
+        if (adc_rapid(adc, ch, lo * 10, hi * 10, key_names[k].code) < 0) {
+          sprintf(err_str, "Invalid rapid trigger channel or points (%s)", cmd[1]);
           parse_err(err_str);
           return(0);
         }
       }
-      /* Otherwise we assume it is a direct pin definition */
-      else {
-        gpio = (int) strtol(cmd[1], &end_ptr, 10);
-        if (!*end_ptr) {
+      else if (sscanf(cmd[1], "%31[^:]:%i/%i/%i", adc_name, &ch, &lo, &hi) != 4) {
+        sprintf(err_str, "Invalid ADC window definition: %s", cmd[1]);
+        parse_err(err_str);
+        return(0);
+      }
+      else if ((adc = adc_find(adc_name)) < 0) {
+        sprintf(err_str, "Unknown ADC: %s", adc_name);
+        parse_err(err_str);
+        return(0);
+      }
+      else if (adc_key(adc, ch, lo, hi, key_names[k].code) < 0) {
+        sprintf(err_str, "Invalid ADC channel or window (%s)", cmd[1]);
+        parse_err(err_str);
+        return(0);
+      }
+    }
 
-          if(key_names[k].code < 0x300){
-            SP=0;
-            add_event(&gpio_key[gpio], gpio, key_names[k].code, -1);
-          }
-        }
-        else {
-          sprintf(err_str, "Unknown KEY definition (%s)", cmd[1]);
-          parse_err(err_str);
-          return(0);
+    /**
+     ** ABS_ axis on an ADC channel
+     ** ===========================
+     **/
+    else if (strncmp(cmd[0], "ABS_", 4) == 0) {
+
+      static const struct { const char *name; int code; } abs_names[] = {
+        { "ABS_X", ABS_X }, { "ABS_Y", ABS_Y }, { "ABS_Z", ABS_Z },
+        { "ABS_RX", ABS_RX }, { "ABS_RY", ABS_RY }, { "ABS_RZ", ABS_RZ },
+        { "ABS_THROTTLE", ABS_THROTTLE }, { "ABS_RUDDER", ABS_RUDDER },
+        { "ABS_WHEEL", ABS_WHEEL }, { "ABS_GAS", ABS_GAS },
+        { "ABS_BRAKE", ABS_BRAKE }, { "ABS_HAT0X", ABS_HAT0X },
+        { "ABS_HAT0Y", ABS_HAT0Y },
+        { NULL, 0 }
+      };
+      char adc_name[32];
+      int adc, ch, code = -1;
+
+      /* verify our syntax */
+      if (tok_cnt != 2) {
+        sprintf(err_str, "\'%s\' definition requires 1 value. (%d given)", cmd[0], tok_cnt-1);
+        parse_err(err_str);
+        return(0);
+      }
+
+      for (i=0; abs_names[i].name; i++) {
+        if (!strcmp(cmd[0], abs_names[i].name)) {
+          code = abs_names[i].code;
         }
       }
+      if (code < 0) {
+        sprintf(err_str, "Unknown axis (%s)", cmd[0]);
+        parse_err(err_str);
+        return(0);
+      }
+      if (sscanf(cmd[1], "%31[^:]:%i", adc_name, &ch) != 2) {
+        sprintf(err_str, "Invalid ADC channel definition: %s", cmd[1]);
+        parse_err(err_str);
+        return(0);
+      }
+      if ((adc = adc_find(adc_name)) < 0) {
+        sprintf(err_str, "Unknown ADC: %s", adc_name);
+        parse_err(err_str);
+        return(0);
+      }
+      if (adc_axis(adc, ch, code) < 0) {
+        sprintf(err_str, "Invalid or already used ADC channel (%s)", cmd[1]);
+        parse_err(err_str);
+        return(0);
+      }
     }
-    /* expander declarations start with "XIO" */
-=======
+
+    /**
+     ** KEY_ declaration
+     ** ===============
+     **/
+    else if ((strncmp(cmd[0], "KEY", 3) == 0) ||
+             ((macro_find(cmd[0]) >= 0) && (tok_cnt == 2))) {
+
+      int code;
+
+      /* verify our syntax */
+      if (tok_cnt != 2) {
+        sprintf(err_str, "\'KEY\' definition requires 1 value. (%d given)", tok_cnt-1);
+        parse_err(err_str);
+        return(0);
+      }
+
+      /* check it is a known KEY, or a macro to play */
+      if ((i = macro_find(cmd[0])) >= 0) {
+        code = MACRO_KEY + i;
+      }
+      else if ((k = find_key(cmd[0])) == 0) {
+        sprintf(err_str, "Unknown KEY value (%s)", cmd[0]);
+        parse_err(err_str);
+        return(0);
+      }
+      else {
+        code = key_names[k].code;
+        uinput_use_key(code);
+      }
+
       switch(get_pin_ref(cmd[1], &gpio, &grp_id, &xio)) {
         case 0:
           printf("KEY Configuration - Ineternal Error\n");
@@ -293,16 +359,21 @@ int init_config(void) {
             return(0);
         }
         mat_grp[grp_id].last_gpio = mat_grp[grp_id].gpio_mask;
-        add_event(&(mat_grp[grp_id].gpio_key[gpio]), gpio, key_names[k].code, -1);
+        add_event(&(mat_grp[grp_id].gpio_key[gpio]), gpio, code, -1);
       }
       else if (xio >= 0) {
-        add_event(&xio_dev[xio].key[gpio], gpio, key_names[k].code, -1);
+        if ((gpio < 0) || (gpio >= xio_driver(xio_dev[xio].type)->width)) {
+          sprintf(err_str, "Expander pin out of range (%s)", cmd[1]);
+          parse_err(err_str);
+          return(0);
+        }
+        add_event(&xio_dev[xio].key[gpio], gpio, code, -1);
         if (debug_lvl() >= DEBUG_DEV1) {
-          printf(" Added event %s on %s:%d\n", key_names[k].code, xname, gpio);
+          printf(" Added event %s on %s:%d\n", cmd[0], xio_dev[xio].name, gpio);
         }
       }
       else {
-        if (key_names[k].code < 0x300) {
+        if ((code < 0x300) || macro_is_key(code)) {
           SP=0;
           switch (gpio_pincfg(gpio, GPIO_IN, &mat_grp[0].gpio_mask)) {
             case 0:
@@ -315,181 +386,775 @@ int init_config(void) {
               return(0);
           }
           mat_grp[0].last_gpio = mat_grp[0].gpio_mask;
-          add_event(&(mat_grp[0].gpio_key[gpio]), gpio, key_names[k].code, -1);
+          add_event(&(mat_grp[0].gpio_key[gpio]), gpio, code, -1);
+        }
+        else {
+          sprintf(err_str, "Not a key or a defined macro (%s)", cmd[0]);
+          parse_err(err_str);
+          return(0);
+        }
+      }
+    }
+
+    /**
+     ** MACRO key sequence declaration
+     ** ==============================
+     **/
+    else if (strncmp(cmd[0], "MACRO", 5) == 0) {
+
+      if (tok_cnt < 2) {
+        sprintf(err_str, "\'%s\' definition requires at least 1 step.", cmd[0]);
+        parse_err(err_str);
+        return(0);
+      }
+      if ((i = macro_find(cmd[0])) >= 0) {
+        sprintf(err_str, "Macro already defined (%s)", cmd[0]);
+        parse_err(err_str);
+        return(0);
+      }
+      if ((i = macro_add(cmd[0])) < 0) {
+        sprintf(err_str, "Too many macros (%s)", cmd[0]);
+        parse_err(err_str);
+        return(0);
+      }
+      for (j=1; j<tok_cnt; j+=n) {
+        if ((n = macro_step(i, cmd[j], (j+1 < tok_cnt) ? cmd[j+1] : NULL)) == 0) {
+          sprintf(err_str, "Invalid or too many macro steps (%s)", cmd[j]);
+          parse_err(err_str);
+          return(0);
+        }
+      }
+    }
+
+    /**
+     ** XIO expander declaration
+     ** ========================
+     **/
+    else if (strncmp(cmd[0], "XIO", 3) == 0) {
+
+      /* verify our syntax, the I2C bus is optional */
+      if ((tok_cnt != 2) && (tok_cnt != 3)) {
+        sprintf(err_str, "\'XIO\' expander definition requires 1 or 2 values. (%d given)", tok_cnt-1);
+        parse_err(err_str);
+        return(0);
+      }
+
+      /* check this isn't a duplicate entry */
+      if (find_xio(cmd[0]) != -1) {
+        sprintf(err_str, "Duplicate \'XIO\' expander definition: %s", cmd[0]);
+        parse_err(err_str);
+        return(0);
+      }
+
+      if (xio_count >= MAX_XIO_DEVS) {
+        sprintf(err_str, "Too many \'XIO\' expanders, %d maximum.", MAX_XIO_DEVS);
+        parse_err(err_str);
+        return(0);
+      }
+
+      /* expanders without an interrupt line are polled */
+      if (sscanf(cmd[1], "POLL/%i/%31s", &caddr, xname) == 2) {
+        gpio = -1;
+        n = 3;
+      }
+      else {
+        n=sscanf(cmd[1], "%d/%i/%31s", &gpio, &caddr, xname);
+      }
+      if(n == 3){
+        //printf("%d XIO entry: %s %d %02x %s\n",lnno,name,gpio,caddr,xname);
+
+        /* bus is either a device path or just the adapter number */
+        if (tok_cnt == 3) {
+          int len;
+
+          if (!strncmp(cmd[2], "/dev/", 5)) {
+            len = snprintf(bus_name, sizeof(bus_name), "%s", cmd[2]);
+          }
+          else {
+            len = snprintf(bus_name, sizeof(bus_name), "/dev/i2c-%s", cmd[2]);
+          }
+          if (len >= (int) sizeof(bus_name)) {
+            sprintf(err_str, "I2C bus name too long (%.40s)", cmd[2]);
+            parse_err(err_str);
+            return(0);
+          }
+        }
+        else {
+          strcpy(bus_name, IIC_DEFAULT_BUS);
+        }
+        if ((xio_dev[xio_count].bus = iic_open_bus(bus_name)) < 0) {
+          sprintf(err_str, "Unable to open I2C bus %s", bus_name);
+          parse_err(err_str);
+          return(0);
+        }
+
+        if ((drv = xio_find_driver(xname)) == NULL) {
+          sprintf(err_str, "Unknown expander type %s", xname);
+          parse_err(err_str);
+          return(0);
+        }
+
+        if (drv->spi != iic_is_spi(xio_dev[xio_count].bus)) {
+          sprintf(err_str, "%s needs an %s bus", xname, drv->spi ? "SPI" : "I2C");
+          parse_err(err_str);
+          return(0);
+        }
+
+        xio_dev[xio_count].name = strdup(cmd[0]);
+        xio_dev[xio_count].addr = caddr;
+        xio_dev[xio_count].type = drv->type;
+        xio_dev[xio_count].regno = drv->base;
+        xio_dev[xio_count].regptr = -1;
+        xio_dev[xio_count].poll_rate = (gpio < 0) ? XIO_POLL_RATE : 0;
+        xio_dev[xio_count].last_key = NULL;
+        xio_dev[xio_count].raw = (1 << drv->width) - 1;
+        xio_dev[xio_count].stable = xio_dev[xio_count].raw;
+        xio_dev[xio_count].smp_head = xio_dev[xio_count].smp_tail = 0;
+        xio_dev[xio_count].rpt_flg = 0;
+        for(i=0;i<MAX_XIO_PINS;i++){
+          xio_dev[xio_count].key[i] = NULL;
+          xio_dev[xio_count].key_rpt[i].idx = -1;
+        }
+
+        xio_count++;
+
+        /* the interrupt line is an input so gpio_poll() will see it */
+        if (gpio >= 0) {
+          add_event(&(mat_grp[0].gpio_key[gpio]), gpio, 0, xio_count-1);
+          if (gpio_pincfg(gpio, GPIO_IN, &mat_grp[0].gpio_mask) == -1) {
+            sprintf(err_str, "GPIO%0d already configured for output.", gpio);
+            parse_err(err_str);
+            return(0);
+          }
+          mat_grp[0].last_gpio = mat_grp[0].gpio_mask;
+        }
+      }
+      else {
+        sprintf(err_str, "Invalid XIO data for %s [%s]", cmd[0], cmd[1]);
+        parse_err(err_str);
+        return(0);
+      }
+    }
+
+    /**
+     ** MATRIX group definition
+     ** =======================
+     **/
+    else if (strncmp(cmd[0], "MATRIX", 6) == 0) {
+
+      /* check this isn't a duplicate entry */
+      if (find_mat(cmd[0]) != -1) {
+        sprintf(err_str, "Duplicate \'MATIX\' group definition: %s", cmd[0]);
+        parse_err(err_str);
+        return(0);
+      }
+
+      /* verify our syntax */
+      if (tok_cnt != 2) {
+        sprintf(err_str, "\'MATRIX\' group definition requires 1 value. (%d given)", tok_cnt-1);
+        parse_err(err_str);
+        return(0);
+      }
+
+      gpio = get_gpio_pin(cmd[1]);
+      if (gpio >= 0) {
+        mat_cnt++;
+        mat_grp = (mat_grp_s *) realloc((void *) mat_grp, sizeof(mat_grp_s) * (mat_cnt + 1));
+        memset((void *) &mat_grp[mat_cnt], 0, sizeof(mat_grp_s));
+        mat_grp[mat_cnt].name = strdup(cmd[0]);
+        mat_grp[mat_cnt].gpio = gpio;
+
+        switch (gpio_pincfg(gpio, GPIO_OUT, (int *) 0)) {
+          case 2:
+            sprintf(err_str, "Matrix driver GPIO%02d already configured.", gpio);
+            parse_err(err_str);
+            return(0);
+          case 0:
+            sprintf(err_str, "INTERNAL ERROR: gpio_pincfg()");
+            parse_err(err_str);
+            return(0);
+          case -1:
+            sprintf(err_str, "GPIO%0d already configured for output.", gpio);
+            parse_err(err_str);
+            return(0);
         }
       }
+      else {
+        sprintf(err_str, "Invalid GPIO PIN reference (%s)", cmd[1]);
+        parse_err(err_str);
+        return(0);
+      }
+    }
+
+    /**
+     ** PULL Internal Pull Resistor configuration
+     ** ==========================================
+     **/
+    else if (strncmp(cmd[0], "PULL", 4) == 0) {
+
+      int mode;
+
+      /* verify our syntax */
+      if (tok_cnt != 2) {
+        sprintf(err_str, "\'PULL\' definition requires 1 value. (%d given)", tok_cnt-1);
+        parse_err(err_str);
+        return(0);
+      }
+
+      if (!strcmp(cmd[0], "PULL_DOWN")) {
+        mode = PUD_DOWN;
+      }
+      else if (!strcmp(cmd[0], "PULL_UP")) {
+        mode = PUD_UP;
+      }
+      else if (!strcmp(cmd[0], "PULL_FLOAT")) {
+        mode = PUD_OFF;
+      }
+      else {
+        sprintf(err_str, "Invalid PULL command (%s)", cmd[0]);
+        parse_err(err_str);
+        return(0);
+      }
+
+      /* pulls are only planned here and applied once the file is read */
+      gpio = get_gpio_pin(cmd[1]);
+      if ((gpio >= 0) && (gpio < NUM_GPIO)) {
+        for (i=0; i<3; i++) {
+          pull_plan[i] &= ~(1 << gpio);
+        }
+        pull_plan[mode] |= 1 << gpio;
+      }
+      else {
+        sprintf(err_str, "Invalid GPIO PIN reference (%s)", cmd[1]);
+        parse_err(err_str);
+        return(0);
+      }
+    }
+
+    /**
+     ** TOUCH thresholds for touch controllers
+     ** ======================================
+     **/
+    else if (strncmp(cmd[0], "TOUCH", 5) == 0) {
+
+      int touch, release, debounce = 0;
+
+      /* verify our syntax */
+      if ((tok_cnt != 3) && (tok_cnt != 4)) {
+        sprintf(err_str, "\'TOUCH\' definition requires 2 or 3 values. (%d given)", tok_cnt-1);
+        parse_err(err_str);
+        return(0);
+      }
+
+      if ((xio = find_xio(cmd[1])) < 0) {
+        sprintf(err_str, "Unknown expander: %s", cmd[1]);
+        parse_err(err_str);
+        return(0);
+      }
+      if (xio_dev[xio].type != IO_MPR121) {
+        sprintf(err_str, "Expander %s is not a touch controller.", cmd[1]);
+        parse_err(err_str);
+        return(0);
+      }
+
+      if ((sscanf(cmd[2], "%i/%i", &touch, &release) != 2) ||
+          (touch < 1) || (touch > 255) || (release < 1) || (release >= touch)) {
+        sprintf(err_str, "Invalid touch/release thresholds (%s)", cmd[2]);
+        parse_err(err_str);
+        return(0);
+      }
+      if (tok_cnt == 4) {
+        debounce = (int) strtol(cmd[3], &end_ptr, 10);
+        if (*end_ptr || (debounce < 0) || (debounce > 7)) {
+          sprintf(err_str, "Invalid touch debounce (%s), 0 to 7 samples", cmd[3]);
+          parse_err(err_str);
+          return(0);
+        }
+      }
+      xio_dev[xio].touch = touch;
+      xio_dev[xio].release = release;
+      xio_dev[xio].debounce = debounce;
+    }
+
+    /**
+     ** POLL_RATE for expanders without an interrupt line
+     ** =================================================
+     **/
+    else if (strncmp(cmd[0], "POLL_RATE", 9) == 0) {
+
+      int rate;
+
+      /* verify our syntax */
+      if (tok_cnt != 3) {
+        sprintf(err_str, "\'POLL_RATE\' definition requires 2 values. (%d given)", tok_cnt-1);
+        parse_err(err_str);
+        return(0);
+      }
+
+      if ((xio = find_xio(cmd[1])) < 0) {
+        sprintf(err_str, "Unknown expander: %s", cmd[1]);
+        parse_err(err_str);
+        return(0);
+      }
+      if (!xio_dev[xio].poll_rate) {
+        sprintf(err_str, "Expander %s is interrupt driven, not polled.", cmd[1]);
+        parse_err(err_str);
+        return(0);
+      }
+
+      rate = (int) strtol(cmd[2], &end_ptr, 10);
+      if (*end_ptr || (rate <= 0)) {
+        sprintf(err_str, "Invalid poll rate (%s)", cmd[2]);
+        parse_err(err_str);
+        return(0);
+      }
+      xio_dev[xio].poll_rate = rate;
+    }
+
+    /**
+     ** I2C_BUDGET share of the bus given to polling
+     ** ============================================
+     **/
+    else if (strncmp(cmd[0], "I2C_BUDGET", 10) == 0) {
+
+      int bus, pct, clock = 0;
+
+      /* verify our syntax */
+      if ((tok_cnt != 3) && (tok_cnt != 4)) {
+        sprintf(err_str, "\'I2C_BUDGET\' definition requires 2 or 3 values. (%d given)", tok_cnt-1);
+        parse_err(err_str);
+        return(0);
+      }
+
+      if ((bus = iic_open_bus(cmd[1])) < 0) {
+        sprintf(err_str, "Unable to open I2C bus %s", cmd[1]);
+        parse_err(err_str);
+        return(0);
+      }
+
+      pct = (int) strtol(cmd[2], &end_ptr, 10);
+      if ((*end_ptr && strcmp(end_ptr, "%")) || (pct <= 0) || (pct > 100)) {
+        sprintf(err_str, "Invalid bus budget (%s)", cmd[2]);
+        parse_err(err_str);
+        return(0);
+      }
+      if (tok_cnt == 4) {
+        clock = (int) strtol(cmd[3], &end_ptr, 10);
+        if (*end_ptr || (clock <= 0)) {
+          sprintf(err_str, "Invalid bus clock (%s)", cmd[3]);
+          parse_err(err_str);
+          return(0);
+        }
+      }
+      iic_set_budget(bus, pct, clock);
+    }
+
+    /**
+     ** I2C_RECOVER bus recovery pins
+     ** =============================
+     **/
+    else if (strncmp(cmd[0], "I2C_RECOVER", 11) == 0) {
+
+      char scl_str[32], sda_str[32];
+      int bus, scl, sda;
+
+      /* verify our syntax */
+      if (tok_cnt != 3) {
+        sprintf(err_str, "\'I2C_RECOVER\' definition requires 2 values. (%d given)", tok_cnt-1);
+        parse_err(err_str);
+        return(0);
+      }
+
+      if ((bus = iic_open_bus(cmd[1])) < 0) {
+        sprintf(err_str, "Unable to open I2C bus %s", cmd[1]);
+        parse_err(err_str);
+        return(0);
+      }
+
+      if ((sscanf(cmd[2], "%31[^/]/%31s", scl_str, sda_str) != 2) ||
+          ((scl = get_gpio_pin(scl_str)) < 0) ||
+          ((sda = get_gpio_pin(sda_str)) < 0)) {
+        sprintf(err_str, "Invalid I2C recovery pins (%s)", cmd[2]);
+        parse_err(err_str);
+        return(0);
+      }
+      iic_set_recovery(bus, scl, sda);
+    }
+
+    /**
+     ** MOUSE pointer from direction switches
+     ** =====================================
+     **/
+    else if (strncmp(cmd[0], "MOUSE", 5) == 0) {
+
+      int v[3];
+
+      if (!strcmp(cmd[0], "MOUSE_SPEED")) {
+        if ((tok_cnt != 4) ||
+            ((v[0] = (int) strtol(cmd[1], &end_ptr, 10)) <= 0) || *end_ptr ||
+            ((v[1] = (int) strtol(cmd[2], &end_ptr, 10)) <= 0) || *end_ptr ||
+            ((v[2] = (int) strtol(cmd[3], &end_ptr, 10)) < 0) || *end_ptr) {
+          sprintf(err_str, "\'MOUSE_SPEED\' requires start and max pixels/s and ramp time in ms");
+          parse_err(err_str);
+          return(0);
+        }
+        mouse_set_speed(v[0], v[1], v[2]);
+      }
+      else if (!strcmp(cmd[0], "MOUSE_RATE")) {
+        if ((tok_cnt != 2) ||
+            ((v[0] = (int) strtol(cmd[1], &end_ptr, 10)) <= 0) || *end_ptr ||
+            (v[0] > 8000)) {
+          sprintf(err_str, "\'MOUSE_RATE\' requires a rate of 1 to 8000 Hz");
+          parse_err(err_str);
+          return(0);
+        }
+        mouse_set_rate(v[0]);
+      }
+      else {
+        if ((i = mouse_find_input(cmd[0])) < 0) {
+          sprintf(err_str, "Unknown mouse input (%s)", cmd[0]);
+          parse_err(err_str);
+          return(0);
+        }
+        if (tok_cnt != 2) {
+          sprintf(err_str, "\'%s\' definition requires 1 value. (%d given)", cmd[0], tok_cnt-1);
+          parse_err(err_str);
+          return(0);
+        }
+        gpio = get_gpio_pin(cmd[1]);
+        if ((gpio < 0) || (gpio >= NUM_GPIO)) {
+          sprintf(err_str, "Invalid GPIO PIN reference (%s)", cmd[1]);
+          parse_err(err_str);
+          return(0);
+        }
+        if (mouse_set_pin(i, gpio) < 0) {
+          sprintf(err_str, "%s already set or GPIO%02d not usable as an input", cmd[0], gpio);
+          parse_err(err_str);
+          return(0);
+        }
+      }
+    }
+
+    /**
+     ** COUNTER pulse inputs
+     ** ====================
+     **/
+    else if (strncmp(cmd[0], "COUNTER", 7) == 0) {
+
+      int per = 1, gap = 0, debounce = -1;
+
+      /* verify our syntax */
+      if ((tok_cnt < 3) || (tok_cnt > 5)) {
+        sprintf(err_str, "\'COUNTER\' definition requires 2 to 4 values. (%d given)", tok_cnt-1);
+        parse_err(err_str);
+        return(0);
+      }
+
+      gpio = get_gpio_pin(cmd[1]);
+      if ((gpio < 0) || (gpio >= NUM_GPIO)) {
+        sprintf(err_str, "Invalid GPIO PIN reference (%s)", cmd[1]);
+        parse_err(err_str);
+        return(0);
+      }
+      if ((k = find_key(cmd[2])) == 0) {
+        sprintf(err_str, "Unknown KEY value (%s)", cmd[2]);
+        parse_err(err_str);
+        return(0);
+      }
+      uinput_use_key(key_names[k].code);
+
+      /* pulses per key, or BURST with an optional gap in ms */
+      if (tok_cnt >= 4) {
+        if (!strcmp(cmd[3], "BURST")) {
+          per = 0;
+        }
+        else if (sscanf(cmd[3], "BURST/%i", &gap) == 1) {
+          per = 0;
+          if (gap <= 0) {
+            sprintf(err_str, "Invalid burst gap (%s)", cmd[3]);
+            parse_err(err_str);
+            return(0);
+          }
+        }
+        else {
+          per = (int) strtol(cmd[3], &end_ptr, 10);
+          if (*end_ptr || (per <= 0)) {
+            sprintf(err_str, "Invalid pulses per key (%s)", cmd[3]);
+            parse_err(err_str);
+            return(0);
+          }
+        }
+      }
+      if (tok_cnt == 5) {
+        debounce = (int) strtol(cmd[4], &end_ptr, 10);
+        if (*end_ptr || (debounce < 0)) {
+          sprintf(err_str, "Invalid debounce time (%s)", cmd[4]);
+          parse_err(err_str);
+          return(0);
+        }
+      }
+
+      if (counter_add(cmd[0], gpio, key_names[k].code, per, gap, debounce) < 0) {
+        sprintf(err_str, "Unable to add counter %s, pin in use or too many counters", cmd[0]);
+        parse_err(err_str);
+        return(0);
+      }
+    }
+
+    /**
+     ** ENCODER quadrature inputs
+     ** =========================
+     **/
+    else if (strncmp(cmd[0], "ENCODER", 7) == 0) {
+
+      static const struct { const char *name; int code; } rel_names[] = {
+        { "REL_X", REL_X }, { "REL_Y", REL_Y },
+        { "REL_WHEEL", REL_WHEEL }, { "REL_HWHEEL", REL_HWHEEL },
+        { NULL, 0 }
+      };
+      char a_str[32], b_str[32];
+      int pin_a, pin_b, steps = ENC_STEPS;
+      int type = EV_KEY, cw = -1, ccw = -1;
+
+      /* verify our syntax */
+      if ((tok_cnt != 3) && (tok_cnt != 4)) {
+        sprintf(err_str, "\'ENCODER\' definition requires 2 or 3 values. (%d given)", tok_cnt-1);
+        parse_err(err_str);
+        return(0);
+      }
+
+      if ((sscanf(cmd[1], "%31[^/]/%31s", a_str, b_str) != 2) ||
+          ((pin_a = get_gpio_pin(a_str)) < 0) || (pin_a >= NUM_GPIO) ||
+          ((pin_b = get_gpio_pin(b_str)) < 0) || (pin_b >= NUM_GPIO) ||
+          (pin_a == pin_b)) {
+        sprintf(err_str, "Invalid encoder pins (%s)", cmd[1]);
+        parse_err(err_str);
+        return(0);
+      }
+
+      /* a relative axis, or a key for each direction */
+      for (i=0; rel_names[i].name; i++) {
+        if (!strcmp(cmd[2], rel_names[i].name)) {
+          type = EV_REL;
+          cw = rel_names[i].code;
+        }
+      }
+      if ((type == EV_KEY) && (sscanf(cmd[2], "%31[^/]/%31s", a_str, b_str) == 2)) {
+        if ((k = find_key(a_str)) != 0) {
+          cw = key_names[k].code;
+        }
+        if ((k = find_key(b_str)) != 0) {
+          ccw = key_names[k].code;
+        }
+      }
+      if ((cw < 0) || ((type == EV_KEY) && (ccw < 0))) {
+        sprintf(err_str, "Invalid encoder output (%s)", cmd[2]);
+        parse_err(err_str);
+        return(0);
+      }
+
+      if (tok_cnt == 4) {
+        steps = (int) strtol(cmd[3], &end_ptr, 10);
+        if (*end_ptr || (steps <= 0)) {
+          sprintf(err_str, "Invalid encoder steps per detent (%s)", cmd[3]);
+          parse_err(err_str);
+          return(0);
+        }
+      }
+
+      if (encoder_add(cmd[0], pin_a, pin_b, type, cw, ccw, steps) < 0) {
+        sprintf(err_str, "Unable to add encoder %s, pins in use or too many encoders", cmd[0]);
+        parse_err(err_str);
+        return(0);
+      }
+      if (type == EV_REL) {
+        uinput_use_rel(cw);
+      }
+      else {
+        uinput_use_key(cw);
+        uinput_use_key(ccw);
+      }
+    }
+
+    /**
+     ** IR remote control receiver
+     ** ==========================
+     **/
+    else if (strncmp(cmd[0], "IR", 2) == 0) {
+
+      /* verify our syntax */
+      if (tok_cnt != 2) {
+        sprintf(err_str, "\'IR\' definition requires 1 value. (%d given)", tok_cnt-1);
+        parse_err(err_str);
+        return(0);
+      }
+
+      gpio = get_gpio_pin(cmd[1]);
+      if ((gpio < 0) || (gpio >= NUM_GPIO)) {
+        sprintf(err_str, "Invalid GPIO PIN reference (%s)", cmd[1]);
+        parse_err(err_str);
+        return(0);
+      }
+      if (ir_add(cmd[0], gpio) < 0) {
+        sprintf(err_str, "Unable to add IR receiver %s, pin in use or too many receivers", cmd[0]);
+        parse_err(err_str);
+        return(0);
+      }
+    }
+
+    /**
+     ** PS2 keyboard receiver
+     ** =====================
+     **/
+    else if (strncmp(cmd[0], "PS2", 3) == 0) {
+
+      char clk_str[32], data_str[32];
+      int clk, data;
+
+      /* verify our syntax */
+      if (tok_cnt != 2) {
+        sprintf(err_str, "\'PS2\' definition requires 1 value. (%d given)", tok_cnt-1);
+        parse_err(err_str);
+        return(0);
+      }
+
+      if ((sscanf(cmd[1], "%31[^/]/%31s", clk_str, data_str) != 2) ||
+          ((clk = get_gpio_pin(clk_str)) < 0) || (clk >= NUM_GPIO) ||
+          ((data = get_gpio_pin(data_str)) < 0) || (data >= NUM_GPIO) ||
+          (clk == data)) {
+        sprintf(err_str, "Invalid PS/2 pins (%s)", cmd[1]);
+        parse_err(err_str);
+        return(0);
+      }
+      if (ps2_add(cmd[0], clk, data) < 0) {
+        sprintf(err_str, "Unable to add PS/2 receiver %s, pins in use or too many receivers", cmd[0]);
+        parse_err(err_str);
+        return(0);
+      }
+    }
+
+    /**
+     ** ADC analog to digital converter
+     ** ===============================
+     **/
+    else if (strncmp(cmd[0], "ADC", 3) == 0) {
+
+      int rate = 0;
+
+      /* verify our syntax */
+      if ((tok_cnt != 3) && (tok_cnt != 4)) {
+        sprintf(err_str, "\'ADC\' definition requires 2 or 3 values. (%d given)", tok_cnt-1);
+        parse_err(err_str);
+        return(0);
+      }
+
+      if (tok_cnt == 4) {
+        rate = (int) strtol(cmd[3], &end_ptr, 10);
+        if (*end_ptr || (rate <= 0)) {
+          sprintf(err_str, "Invalid sample rate (%s)", cmd[3]);
+          parse_err(err_str);
+          return(0);
+        }
+      }
+
+      switch (adc_add(cmd[0], cmd[1], cmd[2], rate)) {
+        case -1:
+          sprintf(err_str, "Unknown ADC type or too many ADCs (%s)", cmd[1]);
+          parse_err(err_str);
+          return(0);
+        case -2:
+          sprintf(err_str, "Unable to open SPI device %s", cmd[2]);
+          parse_err(err_str);
+          return(0);
+      }
     }
 
     /**
-     ** XIO expander declaration
-     ** ========================
+     ** DEVICE names and IDs of the virtual input devices
+     ** =================================================
      **/
->>>>>>> key_matrix
-    else if (strncmp(cmd[0], "XIO", 3) == 0) {
+    else if (strcmp(cmd[0], "DEVICE") == 0) {
 
-      /* verify our syntax */
-      if (tok_cnt != 2) {
-        sprintf(err_str, "\'XIO\' expander definition requires 1 value. (%d given)", tok_cnt-1);
+      unsigned vendor, product;
+
+      if ((tok_cnt != 3) && (tok_cnt != 4)) {
+        sprintf(err_str, "\'DEVICE\' definition requires 2 or 3 values. (%d given)", tok_cnt-1);
         parse_err(err_str);
         return(0);
       }
-
-<<<<<<< HEAD
-      n=sscanf(cmd[1], "%d/%i/%s", &gpio, &caddr, xname);
-      if(n > 2){
-        //printf("%d XIO entry: %s %d %02x %s\n",lnno,name,gpio,caddr,xname);
-
-        strncpy(xio_dev[xio_count].name, cmd[0], 20);
-=======
-      /* check this isn't a duplicate entry */
-      if (find_xio(cmd[0]) != -1) {
-        sprintf(err_str, "Duplicate \'XIO\' expander definition: %s", cmd[0]);
+      vendor = product = (unsigned) -1;
+      if ((tok_cnt == 4) &&
+          ((sscanf(cmd[3], "%x:%x", &vendor, &product) != 2) ||
+           (vendor > 0xffff) || (product > 0xffff))) {
+        sprintf(err_str, "Invalid vendor:product ID (%s)", cmd[3]);
         parse_err(err_str);
         return(0);
       }
-
-      n=sscanf(cmd[1], "%d/%i/%s", &gpio, &caddr, xname);
-      if(n == 3){
-        //printf("%d XIO entry: %s %d %02x %s\n",lnno,name,gpio,caddr,xname);
-
-        xio_dev[xio_count].name = strdup(cmd[0]);
->>>>>>> key_matrix
-        xio_dev[xio_count].addr = caddr;
-        xio_dev[xio_count].last_key = NULL;
-        xio_dev[xio_count].lastvalue = 0xff;
-        for(i=0;i<8;i++){
-          xio_dev[xio_count].key[i] = NULL;
-        }
-        if( !strncmp(xname, "MCP23008", 8) ){
-          xio_dev[xio_count].type = IO_MCP23008;
-          xio_dev[xio_count].regno = 0x09;
-        }
-        else if( !strncmp(xname, "MCP23017A", 9) ){
-          xio_dev[xio_count].type = IO_MCP23017A;
-          xio_dev[xio_count].regno = 0x09;
-        }
-        else if( !strncmp(xname, "MCP23017B", 9) ){
-          xio_dev[xio_count].type = IO_MCP23017B;
-          xio_dev[xio_count].regno = 0x19;
-        }
-        else{
-          xio_dev[xio_count].type = IO_UNK;
-          xio_dev[xio_count].regno = 0;
-        }
-
-<<<<<<< HEAD
-        add_event(&gpio_key[gpio], gpio, 0, xio_count);
-        xio_count++;
-        xio_count %= 16;
-=======
-        add_event(&(mat_grp[0].gpio_key[gpio]), gpio, 0, xio_count);
-        xio_count++;
-        xio_count %= MAX_XIO_DEVS;
->>>>>>> key_matrix
-      }
-      else {
-        sprintf(err_str, "Invalid XIO data for %s [%s]", cmd[0], cmd[1]);
+      if (uinput_device(cmd[1], cmd[2], (int) vendor, (int) product) < 0) {
+        sprintf(err_str, "Unknown device class (%s)", cmd[1]);
         parse_err(err_str);
         return(0);
       }
     }
-<<<<<<< HEAD
-    else{
-=======
 
     /**
-     ** MATRIX group definition
-     ** =======================
+     ** STREAM of input records on a Unix socket
+     ** ========================================
      **/
-    else if (strncmp(cmd[0], "MATRIX", 6) == 0) {
+    else if (strcmp(cmd[0], "STREAM") == 0) {
 
-      /* check this isn't a duplicate entry */
-      if (find_mat(cmd[0]) != -1) {
-        sprintf(err_str, "Duplicate \'MATIX\' group definition: %s", cmd[0]);
+      if (tok_cnt > 2) {
+        sprintf(err_str, "\'STREAM\' takes at most 1 value. (%d given)", tok_cnt-1);
         parse_err(err_str);
         return(0);
       }
-
-      /* verify our syntax */
-      if (tok_cnt != 2) {
-        sprintf(err_str, "\'MATRIX\' group definition requires 1 value. (%d given)", tok_cnt-1);
+      if (stream_open((tok_cnt == 2) ? cmd[1] : STREAM_PATH) < 0) {
+        sprintf(err_str, "Unable to open the stream socket %s", (tok_cnt == 2) ? cmd[1] : STREAM_PATH);
         parse_err(err_str);
         return(0);
       }
+    }
 
-      gpio = get_gpio_pin(cmd[1]);
-      if (gpio >= 0) {
-        mat_cnt++;
-        mat_grp = (mat_grp_s *) realloc((void *) mat_grp, sizeof(mat_grp_s) * (mat_cnt + 1));
-        memset((void *) &mat_grp[mat_cnt], 0, sizeof(mat_grp_s));
-        mat_grp[mat_cnt].name = strdup(cmd[0]);
-        mat_grp[mat_cnt].gpio = gpio;
+    /**
+     ** KEYSTATE table in shared memory
+     ** ===============================
+     **/
+    else if (strcmp(cmd[0], "KEYSTATE") == 0) {
 
-        switch (gpio_pincfg(gpio, GPIO_OUT, (int *) 0)) {
-          case 2:
-            sprintf(err_str, "Matrix driver GPIO%02d already configured.", gpio);
-            parse_err(err_str);
-            return(0);
-          case 0:
-            sprintf(err_str, "INTERNAL ERROR: gpio_pincfg()");
-            parse_err(err_str);
-            return(0);
-          case -1:
-            sprintf(err_str, "GPIO%0d already configured for output.", gpio);
-            parse_err(err_str);
-            return(0);
-        }
+      if (tok_cnt > 2) {
+        sprintf(err_str, "\'KEYSTATE\' takes at most 1 value. (%d given)", tok_cnt-1);
+        parse_err(err_str);
+        return(0);
       }
-      else {
-        sprintf(err_str, "Invalid GPIO PIN reference (%s)", cmd[1]);
+      if (keystate_open((tok_cnt == 2) ? cmd[1] : KEYSTATE_PATH) < 0) {
+        sprintf(err_str, "Unable to create the key state table %s", (tok_cnt == 2) ? cmd[1] : KEYSTATE_PATH);
         parse_err(err_str);
         return(0);
       }
     }
 
     /**
-     ** PULL Internal Pull Resistor configuration
-     ** ==========================================
+     ** HOLD_KEYS down until released, repeat by the kernel
+     ** ===================================================
      **/
-    else if (strncmp(cmd[0], "PULL", 4) == 0) {
-
-      int mode;
+    else if (strcmp(cmd[0], "HOLD_KEYS") == 0) {
 
-      /* verify our syntax */
-      if (tok_cnt != 2) {
-        sprintf(err_str, "\'PULL\' definition requires 1 value. (%d given)", tok_cnt-1);
-        parse_err(err_str);
-        return(0);
-      }
+      int delay = REP_DELAY_MS, period = REP_PERIOD_MS;
 
-      if (!strcmp(cmd[0], "PULL_DOWN")) {
-        mode = PUD_DOWN;
-      }
-      else if (!strcmp(cmd[0], "PULL_UP")) {
-        mode = PUD_UP;
-      }
-      else if (!strcmp(cmd[0], "PULL_FLOAT")) {
-        mode = PUD_OFF;
-      }
-      else {
-        sprintf(err_str, "Invalid PULL command (%s)", cmd[0]);
+      if ((tok_cnt != 1) && (tok_cnt != 3)) {
+        sprintf(err_str, "\'HOLD_KEYS\' takes no values or a repeat delay and period. (%d given)", tok_cnt-1);
         parse_err(err_str);
         return(0);
       }
-
-      gpio = get_gpio_pin(cmd[1]);
-      if (gpio >= 0) {
-        if (!gpio_pull(gpio, mode)) {
-          sprintf(err_str, "GPIO%02d pull resister not set, pin no set for input.", gpio);
+      if (tok_cnt == 3) {
+        if (((delay = (int) strtol(cmd[1], &end_ptr, 10)) < 0) || *end_ptr ||
+            ((period = (int) strtol(cmd[2], &end_ptr, 10)) < 0) || *end_ptr) {
+          sprintf(err_str, "Invalid repeat delay or period (%s %s)", cmd[1], cmd[2]);
           parse_err(err_str);
           return(0);
         }
       }
-      else {
-        sprintf(err_str, "Invalid GPIO PIN reference (%s)", cmd[1]);
-        parse_err(err_str);
-        return(0);
-      }
+      uinput_hold(delay, period);
     }
 
     /**
@@ -550,11 +1215,11 @@ int init_config(void) {
           printf("REPEAT: %s GPIO: %d MATRIX: %d XIO: %d\n", p, gpio, grp_id, xio);
         }
 
-        if (grp_id) {
+        if (grp_id >= 0) {
           mat_grp[grp_id].rpt_flg |= (1<<gpio);
         }
         else if (xio >= 0) {
-          printf("Repeat not imlemented for XIO.\n");
+          xio_dev[xio].rpt_flg |= (1<<gpio);
         }
         else {
           mat_grp[0].rpt_flg |= (1<<gpio);
@@ -562,23 +1227,37 @@ int init_config(void) {
       }
     }
     else {
->>>>>>> key_matrix
       sprintf(err_str, "Unknown configuration item: %s", cmd[0]);
       parse_err(err_str);
       return(0);
     }
-<<<<<<< HEAD
-=======
 
     /* clean up memory allocated at token parsing */
     for (i=0;i<tok_cnt;i++) {
       free(cmd[i]);
     }
     free(cmd);
->>>>>>> key_matrix
   }
 
   close(fd);
+  t_parse = gpio_time_us();
+
+  /* apply the plan: one pull sequence per mode for all its pins */
+  for (i=0; i<3; i++) {
+    if (pull_plan[i]) {
+      n = gpio_pull_mask(pull_plan[i], i);
+      if (n != pull_plan[i]) {
+        for (j=0; j<NUM_GPIO; j++) {
+          if ((pull_plan[i] & ~n) & (1 << j)) {
+            printf("ERROR: %s: GPIO%02d pull resister not set, pin not set for input.\n", parse_filename, j);
+          }
+        }
+        return(0);
+      }
+      pulls++;
+    }
+  }
+  t_pull = gpio_time_us();
 
   n=0;
   for(i=0; i<NUM_GPIO; i++){
@@ -589,127 +1268,33 @@ int init_config(void) {
   }
 
   for(j=0;j<xio_count;j++){
-    for(i=0;i<8;i++){
+    for(i=0;i<MAX_XIO_PINS;i++){
       if(xio_dev[j].key[i]){
 	xio_dev[j].inmask |= 1<<i;
       }
     }
     setup_xio(j);
-    test_iic(xio_dev[j].addr, xio_dev[j].regno & 0x10);
-  }
-
-  if (debug_on()) {
-    test_config();
-  }
-
-<<<<<<< HEAD
-  return(xio_count?2:1);
-}
-
-static int load_buffer(int fd) {
-
-  if (!parse_buf) {
-    parse_buf = (char *) malloc(BUFSIZ+1);
-  }
-  memset( (char *) parse_buf, 0, BUFSIZ+1);
-  parse_bufptr = parse_buf;
-
-  return(read(fd, parse_buf, BUFSIZ));
-}
-
-static char *next_token(int fd) {
-
-  const char whitespace[] = " \t\r#\0";
-  char *tok = (char *) 0;
-
-  /* chew though white space and comments to next token */
-  while ((*parse_bufptr) &&
-         (strchr(whitespace, (int) *parse_bufptr) != NULL)) {
-
-    /* comments run until CR */
-    if (*parse_bufptr == '#') {
-      while ((*parse_bufptr) && (*parse_bufptr != '\n')) {
-        parse_bufptr++;
-        if (*parse_bufptr == (char) 0) {
-          load_buffer(fd);
-        }
-      }
-    }
-    else {
-      parse_bufptr++;
-      if (*parse_bufptr == (char) 0) {
-        load_buffer(fd);
-      }
+    if (xio_dev[j].poll_rate) {
+      iic_set_poll(j, xio_dev[j].poll_rate);
     }
-  }
-
-  /* was this an empty line */
-  if (*parse_bufptr == '\n') {
-    tok = strdup("\n");
-    parse_bufptr++;
-    parse_lnno++;
-  }
-  else {
-
-    /* gobble up the token */
-    while ((*parse_bufptr) &&
-           (strchr(whitespace, (int) *parse_bufptr) == NULL) &&
-           (*parse_bufptr != '\n')) {
+    if (debug_on()) {
+      int v;
 
-      if (tok == (char *) 0) {
-        tok = (char *) malloc(2);
-        memset( (void *) tok, 0, 2);
-        *tok = *parse_bufptr;
-      }
-    else {
-        tok = (char *) realloc( (void *) tok, strlen(tok)+2);
-        tok[strlen(tok)+1] = 0;
-        tok[strlen(tok)] = *parse_bufptr;
-      }
-      parse_bufptr++;
-      if (*parse_bufptr == (char) 0) {
-        load_buffer(fd);
+      if (xio_driver(xio_dev[j].type)->read(&xio_dev[j], &v) == 0) {
+        printf("%s inputs: %04x\n", xio_dev[j].name, v);
       }
     }
   }
 
-  return(tok);
-}
-
-static int next_command(int fd, char ***cmd) {
-
-  char *tok;
-  int cnt = -1;
-
-  *cmd = (char **) 0;
-  while ((tok = next_token(fd)) && (*tok != '\n')) {
+  t_xio = gpio_time_us();
 
-    if (!*cmd) {
-      *cmd = (char **) calloc(1, sizeof(char *));
-      (*cmd)[0] = tok;
-      cnt = 1;
-    }
-    else {
-      cnt++;
-      *cmd = (char **) realloc((void *) *cmd, sizeof(char *)*cnt);
-      (*cmd)[cnt-1] = tok;
-    }
-  }
+  printf("Startup: config %lluus, %d pull sequences %lluus, %d expanders %lluus\n",
+         t_parse - t_start, pulls, t_pull - t_parse, xio_count, t_xio - t_pull);
 
-  /* check if this is just a blank line */
-  if ((cnt == -1) && tok) {
-    cnt = 0;
+  if (debug_on()) {
+    test_config();
   }
 
-  return(cnt);
-}
-
-static void parse_err(char *str) {
-
-  printf("ERROR: %s line %d: %s\n", parse_filename, parse_lnno, str);
-
-  return;
-=======
   if (xio_count) {
     return(2);
   }
@@ -718,7 +1303,6 @@ static void parse_err(char *str) {
   }
 
   return(1);
->>>>>>> key_matrix
 }
 
 int load_buffer(int fd) {
@@ -1144,6 +1728,11 @@ int find_xio(const char *name)
   return i;
 }
 
+xio_dev_s *get_xio(int xio)
+{
+  return &xio_dev[xio];
+}
+
 int is_xio(int gpio)
 {
   int r=0;
@@ -1155,42 +1744,8 @@ int is_xio(int gpio)
 
 void setup_xio(int xio)
 {
-  char cfg_dat[]={
-    0xff, //IODIR
-    0x00, //IPOL
-    xio_dev[xio].inmask,  //GPINTEN - enable interrupts for defined pins
-    0x00, //DEFVAL
-    0x00, //INTCON - monitor changes
-    0x84, //IOCON - interrupt pin is open collector;
-    0xff, //GPPU - enable all pull-ups
-  };
-  char buf[]={0x84};
-  int addr = xio_dev[xio].addr;
-
-  /* first ensure that the bank bit is set */
-  if( write_iic(addr, 0x0a, buf, 1) < 0 ){
-    perror("iic init write 1\n");
-  }
-  buf[0]=0; /* reset OLATA if incorrectly addressed before */
-  if( write_iic(addr, 0x0a, buf, 1) < 0 ){
-    perror("iic init write 2\n");
-  }
-
-  switch(xio_dev[xio].type){
-  case IO_MCP23008:
-    write_iic(addr, 0, cfg_dat, 7); 
-    printf("Configuring MCP23008\n");
-    break;
-  case IO_MCP23017A:
-    write_iic(addr, 0, cfg_dat, 7); 
-    printf("Configuring MCP23017 port A\n");
-    break;
-  case IO_MCP23017B:
-    write_iic(addr, 0x10, cfg_dat, 7); 
-    printf("Configuring MCP23017 port B\n");
-    break;
-  default:
-    break;
+  if( xio_driver(xio_dev[xio].type)->init(&xio_dev[xio]) < 0 ){
+    printf("Failed to configure expander %s\n", xio_dev[xio].name);
   }
 }
 
@@ -1207,9 +1762,10 @@ int get_curr_xio_no(void)
   return r;
 }
 
-void get_xio_parm(int xio, iodev_e *type, int *addr, int *regno)
+void get_xio_parm(int xio, iodev_e *type, int *bus, int *addr, int *regno)
 {
   *type = xio_dev[xio].type;
+  *bus = xio_dev[xio].bus;
   *addr = xio_dev[xio].addr;
   *regno = xio_dev[xio].regno;
 }
@@ -1264,30 +1820,122 @@ void restart_xio_keys(int xio)
  ** I2C Management Routines
  **/
 
+/* Called from the I2C bus workers: the sample is stamped and queued for the
+ * main loop, which does the debouncing and key handling in xio_poll().
+ */
 void handle_iic_event(int xio, int value)
 {
-  int ival = value & xio_dev[xio].inmask;
-  int xval = ival ^ xio_dev[xio].lastvalue;
-  int f,i,k=0,x;
-
-  xio_dev[xio].lastvalue = ival;
-
-  for (i = 0; i < MAX_XIO_PINS; i++){
-    restart_xio_keys(xio);
-    while(got_more_xio_keys(xio, i)){
-      k = get_next_xio_key(xio, i);
-      x = !(ival & (1 << i)); /* is the pin high or low? */
-      f = xval & (1 << i); /* has the pin changed? */
-      if(f){
-	//printf("(%02x) sending %d/%d: %x=%d\n", ival, xio, i, k, x);
-	sendKey(k, 1); /* switch is active low */
-	KI.key = k; KI.val = x;
-        sendKey(k, 0);
+  xio_dev_s *dev = &xio_dev[xio];
+  unsigned head = dev->smp_head;
+
+  if (head - dev->smp_tail >= XIO_SAMPLES) {
+    dev->overrun++;
+    return;
+  }
+  dev->smp[head % XIO_SAMPLES].value = value & dev->inmask;
+  dev->smp[head % XIO_SAMPLES].t = gpio_time_us();
+  __sync_synchronize();
+  dev->smp_head = head + 1;
+}
+
+/* Debounce the queued expander samples and send keys for new presses.
+ * A pin takes its new state once it has been steady for XIO_BOUNCE_US,
+ * measured from the time the sample was taken; called every main loop tick.
+ */
+void xio_poll(int xio)
+{
+  xio_dev_s *dev = &xio_dev[xio];
+  xio_sample_s *smp;
+  gpio_key_s *ev;
+  unsigned long long now;
+  int i, chg, press;
+
+  /* replay the samples, noting when each pin last changed */
+  while (dev->smp_tail != dev->smp_head) {
+    __sync_synchronize();
+    smp = &dev->smp[dev->smp_tail % XIO_SAMPLES];
+
+    chg = smp->value ^ dev->raw;
+    for (i = 0; chg; i++, chg >>= 1) {
+      if (chg & 1) {
+        dev->edge[i] = smp->t;
+        if (dev->inmask & (1 << i)) {
+          stream_event(STREAM_RAW, STREAM_XIO, xio, i, 0, !(smp->value & (1 << i)),
+                       !(dev->stable & (1 << i)), smp->t);
+        }
+      }
+    }
+    dev->raw = smp->value;
+    dev->smp_tail++;
+  }
+
+  if ((dev->overrun != dev->overrun_seen) && debug_on()) {
+    printf("%s: %u samples dropped, main loop fell behind\n", dev->name,
+           dev->overrun - dev->overrun_seen);
+    dev->overrun_seen = dev->overrun;
+  }
+
+  now = gpio_time_us();
+  chg = (dev->raw ^ dev->stable) & dev->inmask;
+  for (i = 0; chg; i++, chg >>= 1) {
+    if ((chg & 1) && (now - dev->edge[i] >= XIO_BOUNCE_US)) {
+      dev->stable ^= 1 << i;
+      uinput_stamp(dev->edge[i]);
+      for (ev = dev->key[i]; ev; ev = ev->next) {
+        keystate_set(ev->key, !(dev->stable & (1 << i)), dev->edge[i]);
+        stream_event(STREAM_KEY, STREAM_XIO, xio, i, ev->key, !(dev->raw & (1 << i)),
+                     !(dev->stable & (1 << i)), dev->edge[i]);
+      }
+
+      /* only send a key on press (pin low), unless keys are held */
+      if (uinput_holding()) {
+        xio_key_state(xio, i, !(dev->stable & (1 << i)));
+      }
+      else if (!(dev->stable & (1 << i))) {
+        xio_send_keys(xio, i);
+      }
+    }
+  }
+
+  press = ~dev->stable & dev->inmask;
+  key_repeat(dev->key_rpt, dev->rpt_flg, &dev->prev_state, press,
+             MAX_XIO_PINS, xio_send_keys, xio);
+}
+
+int xio_send_keys(int xio, int pin)
+{
+  gpio_key_s *ev;
+
+  for (ev = xio_dev[xio].key[pin]; ev; ev = ev->next){
+    if (macro_is_key(ev->key)) {
+      macro_play(ev->key);
+      continue;
+    }
+    sendKey(ev->key, 1);
+    sendKey(ev->key, 0);
+  }
+  return 0;
+}
+
+int xio_key_state(int xio, int pin, int value)
+{
+  gpio_key_s *ev;
+
+  for (ev = xio_dev[xio].key[pin]; ev; ev = ev->next){
+    if (macro_is_key(ev->key)) {
+      if (value) {
+        macro_play(ev->key);
       }
+      continue;
     }
-    //printf("Next pin\n");
+    sendKey(ev->key, value);
   }
-  //printf("handler exit\n");
+  return 0;
+}
+
+int xio_num(void)
+{
+  return(xio_count);
 }
 
 
@@ -1314,10 +1962,7 @@ mat_grp_s *get_matgrp(int grp) {
   return(&mat_grp[grp]);
 }
 
-<<<<<<< HEAD
-=======
 int mat_count(void) {
   return(mat_cnt);
 }
 
->>>>>>> key_matrix
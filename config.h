@@ -29,6 +29,11 @@
 #include "iic.h"
 
 #define NUM_GPIO 32
+#define MAX_XIO_DEVS 32          /* limited by the iic pending mask */
+#define MAX_XIO_PINS 16
+#define XIO_POLL_RATE 100        /* default Hz for expanders without INT */
+#define XIO_SAMPLES 16           /* expander samples queued for the main loop */
+#define XIO_BOUNCE_US 8000       /* a pin must be steady this long */
 
 typedef struct {
   char name[32];
@@ -62,6 +67,8 @@ typedef struct {
   int cur_gpio;                   /* GPIO state currently being processed */
   int last_gpio;                  /* GPIO state at last read */
   int bounce_cnt;                 /* switch bounce delay counter */
+  unsigned long long t_change;    /* when a pin change was first seen */
+  int stable_down;                /* debounced state, bit set when down */
   gpio_key_s *gpio_key[NUM_GPIO];
   gpio_key_s *last_gpio_key;
   /* key repeat variables */
@@ -70,6 +77,41 @@ typedef struct {
   keyrpt_s key_rpt[NUM_GPIO];
 } mat_grp_s;
 
+/* expander input sample as read by a bus worker */
+typedef struct{
+  int value;
+  unsigned long long t;           /* CLOCK_MONOTONIC sample time in us */
+}xio_sample_s;
+
+/* I/O expander, 16-bit chips have all pins in one device */
+typedef struct{
+  char *name;
+  iodev_e type;
+  int addr;
+  int bus;                        /* index from iic_open_bus() */
+  int regno;                      /* register bank base */
+  int regptr;                     /* register the chip points at, -1 unknown */
+  int poll_rate;                  /* samples/s when polled, 0 for INT driven */
+  int touch, release, debounce;   /* touch controller settings, 0 default */
+  int inmask;
+  gpio_key_s *last_key;
+  gpio_key_s *key[MAX_XIO_PINS];
+  /* samples handed from the bus worker to the main loop */
+  xio_sample_s smp[XIO_SAMPLES];
+  volatile unsigned smp_head;     /* written by the bus worker */
+  volatile unsigned smp_tail;     /* written by the main loop */
+  volatile unsigned overrun;      /* samples lost to a full queue */
+  unsigned overrun_seen;          /* overruns already reported */
+  /* debounce, per pin */
+  int raw;                        /* last sampled state */
+  int stable;                     /* debounced state */
+  unsigned long long edge[MAX_XIO_PINS]; /* time of last raw change */
+  /* key repeat variables */
+  int rpt_flg;
+  int prev_state;
+  keyrpt_s key_rpt[MAX_XIO_PINS];
+}xio_dev_s;
+
 int init_config(void);
 int get_event_key(int gpio, int idx);
 int get_next_key(int grp, int gpio);
@@ -80,10 +122,16 @@ int gpio_pin(int n);
 int is_xio(int gpio);
 int get_curr_key(int grp);
 int get_curr_xio_no(void);
-void get_xio_parm(int xio, iodev_e *type, int *addr, int *regno);
+void setup_xio(int xio);
+xio_dev_s *get_xio(int xio);
+void get_xio_parm(int xio, iodev_e *type, int *bus, int *addr, int *regno);
 int get_next_xio_key(int xio, int gpio);
 void restart_xio_keys(int xio);
 void handle_iic_event(int xio, int value);
+void xio_poll(int xio);
+int xio_send_keys(int xio, int pin);
+int xio_key_state(int xio, int pin, int value);
+int xio_num(void);
 mat_grp_s *get_matgrp(int grp);
 int mat_count(void);
 
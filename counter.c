@@ -0,0 +1,209 @@
+/**** counter.c ****************************/
+/*   Universal RPi GPIO keyboard daemon    */
+/*                                         */
+/* pulse counting inputs                   */
+/*******************************************/
+
+/*
+   This file is part of the Universal Raspberry Pi GPIO keyboard daemon.
+
+   This is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   The software is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with the GNU C Library; if not, write to the Free
+   Software Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+   02111-1307 USA.  
+*/
+
+
+/* Pulse trains from coin mechanisms and sensors.  The pin is edge captured
+ * and every falling edge is counted on the edge thread, nothing else, so
+ * the count stays exact whatever the main loop is doing.  The main loop
+ * turns the count into key taps, either one per "per" pulses or one per
+ * burst (pulses with less than the burst gap between them).
+ *
+ * Contacts bounce, so a falling edge only counts once the pin has been
+ * high for the debounce time; the extra edges of a bouncing press or
+ * release come too soon after the edge before them and are ignored.
+ *
+ * Lost edges are caught two ways: the v2 GPIO character device numbers
+ * every edge so kernel drops show up as gaps, and any drop shows as two
+ * edges of the same direction in a row.  Either is always reported since
+ * it means the count can't be trusted.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include "config.h"
+#include "gpio.h"
+#include "edge.h"
+#include "counter.h"
+#include "uinput.h"
+#include "keystate.h"
+#include "stream.h"
+#include "debug.h"
+
+typedef struct{
+  char *name;
+  int pin;
+  int key;
+  int per;                      /* pulses per key, 0 for one per burst */
+  unsigned gap_us;
+  unsigned debounce_us;
+
+  /* edge thread */
+  int level;
+  unsigned long long t_edge;    /* time of the last edge either way */
+  volatile unsigned count;
+  volatile unsigned missed;
+  volatile unsigned bounces;    /* falling edges ignored as bounce */
+  volatile unsigned t_last;     /* low 32 bits of the last pulse time */
+
+  /* main loop only */
+  unsigned done;                /* pulses already turned into keys */
+  unsigned lost_seen;
+  unsigned count_seen;
+  unsigned bounce_seen;
+}counter_s;
+
+static counter_s cnt[MAX_COUNTERS];
+static int cnt_count = 0;
+
+static void counter_edge(void *ctx, int pin, int level, unsigned long long t);
+
+
+/* count pulses on "pin" and tap "key" every "per" pulses, or once for each
+ * burst when "per" is 0.  A "gap_ms" of 0 or a negative "debounce_us"
+ * takes the default.  Returns the counter number or -1.
+ */
+int counter_add(const char *name, int pin, int key, int per, int gap_ms, int debounce_us) {
+
+  counter_s *c;
+
+  if ((cnt_count >= MAX_COUNTERS) || (per < 0)) {
+    return(-1);
+  }
+  c = &cnt[cnt_count];
+  memset(c, 0, sizeof(counter_s));
+  c->name = strdup(name);
+  c->pin = pin;
+  c->key = key;
+  c->per = per;
+  c->gap_us = ((gap_ms > 0) ? gap_ms : COUNT_GAP_MS) * 1000;
+  c->debounce_us = (debounce_us >= 0) ? debounce_us : COUNT_DEBOUNCE_US;
+  c->level = -1;
+
+  if (edge_add(pin, counter_edge, c) < 0) {
+    return(-1);
+  }
+
+  return(cnt_count++);
+}
+
+
+int counter_num(void) {
+
+  return(cnt_count);
+}
+
+
+/* pulses counted so far on counter "n" */
+unsigned counter_value(int n) {
+
+  return(cnt[n].count);
+}
+
+
+/* called on the edge thread, pulses pull the pin low */
+static void counter_edge(void *ctx, int pin, int level, unsigned long long t) {
+
+  counter_s *c = (counter_s *) ctx;
+
+  if (level == c->level) {
+    c->missed++;
+  }
+  c->level = level;
+
+  if (!level && c->t_edge && (t - c->t_edge < c->debounce_us)) {
+    c->bounces++;
+  }
+  else if (!level) {
+    c->t_last = (unsigned) t;
+    __sync_synchronize();
+    c->count++;
+  }
+  c->t_edge = t;
+}
+
+
+/* one key tap for counter "n", "t" is the time of the last pulse */
+static void counter_tap(int n, counter_s *c, unsigned long long t) {
+
+  keystate_set(c->key, 1, t);
+  keystate_set(c->key, 0, t);
+  stream_event(STREAM_KEY, STREAM_COUNTER, n, c->pin, c->key, 1, 1, t);
+  stream_event(STREAM_KEY, STREAM_COUNTER, n, c->pin, c->key, 0, 0, t);
+  sendKey(c->key, 1);
+  sendKey(c->key, 0);
+}
+
+
+/* called from the main loop */
+void counter_poll(void) {
+
+  counter_s *c;
+  unsigned count, lost;
+  unsigned now;
+  unsigned long long t;
+  int i;
+
+  now = (unsigned) gpio_time_us();
+
+  for (i=0; i<cnt_count; i++) {
+    c = &cnt[i];
+    count = c->count;
+    __sync_synchronize();
+    t = gpio_time_us() - (unsigned) (now - c->t_last);
+    uinput_stamp(t);
+
+    if (c->per) {
+      while (count - c->done >= (unsigned) c->per) {
+        counter_tap(i, c, t);
+        c->done += c->per;
+      }
+    }
+    else if ((count != c->done) && (now - c->t_last >= c->gap_us)) {
+      if (debug_on()) {
+        printf("%s: burst of %u pulses\n", c->name, count - c->done);
+      }
+      counter_tap(i, c, t);
+      c->done = count;
+    }
+
+    if (debug_on() && (count != c->count_seen)) {
+      printf("%s: count %u\n", c->name, count);
+      c->count_seen = count;
+    }
+    if (debug_on() && (c->bounces != c->bounce_seen)) {
+      printf("%s: %u bounces ignored\n", c->name, c->bounces - c->bounce_seen);
+      c->bounce_seen = c->bounces;
+    }
+
+    lost = edge_lost(c->pin) + c->missed;
+    if (lost != c->lost_seen) {
+      printf("%s: counter overflow, %u edges lost (count %u)\n", c->name, lost - c->lost_seen, count);
+      syslog(LOG_WARNING, "%s: counter overflow, %u edges lost (count %u)", c->name, lost - c->lost_seen, count);
+      c->lost_seen = lost;
+    }
+  }
+}
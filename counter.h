@@ -0,0 +1,39 @@
+/**** counter.h ****************************/
+/*   Universal RPi GPIO keyboard daemon    */
+/*                                         */
+/* pulse counting inputs                   */
+/*******************************************/
+
+/*
+   This file is part of the Universal Raspberry Pi GPIO keyboard daemon.
+
+   This is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   The software is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with the GNU C Library; if not, write to the Free
+   Software Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+   02111-1307 USA.  
+*/
+
+
+#ifndef _COUNTER_H_
+#define _COUNTER_H_
+
+#define MAX_COUNTERS    8
+#define COUNT_GAP_MS    100     /* default silence that ends a burst */
+#define COUNT_DEBOUNCE_US 1000  /* default time high before a pulse counts */
+
+int counter_add(const char *name, int pin, int key, int per, int gap_ms, int debounce_us);
+int counter_num(void);
+unsigned counter_value(int n);
+void counter_poll(void);
+
+#endif
@@ -28,6 +28,7 @@
 
 #define DEBUG_INFO 1
 #define DEBUG_GPIO 2
+#define DEBUG_IIC 3
 #define DEBUG_DEV1 5
 #define DEBUG_DEV2 6
 #define DEBUG_DEV3 7
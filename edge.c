@@ -0,0 +1,532 @@
+/**** edge.c *******************************/
+/*   Universal RPi GPIO keyboard daemon    */
+/*                                         */
+/* timestamped GPIO edge capture           */
+/*******************************************/
+
+/*
+   This file is part of the Universal Raspberry Pi GPIO keyboard daemon.
+
+   This is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   The software is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with the GNU C Library; if not, write to the Free
+   Software Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+   02111-1307 USA.  
+*/
+
+/* Inputs that can't live with the 4ms scan and its debounce (encoders,
+ * pulse trains, serial protocols) register their pins here.  A single
+ * thread watches them and calls the owner for every edge with the time it
+ * happened.  The kernel's GPIO character device is used when it is there,
+ * giving interrupt driven edges with kernel timestamps (v2 also says when
+ * edges were dropped), otherwise the level register is sampled every
+ * EDGE_SAMPLE_US.  The thread asks for realtime priority.
+ *
+ * Edge handlers run on the edge thread and hand their results to the main
+ * loop through edge_post(), which queues input events for edge_dispatch().
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <linux/gpio.h>
+#include <linux/input.h>
+#include "config.h"
+#include "gpio.h"
+#include "edge.h"
+#include "uinput.h"
+#include "keystate.h"
+#include "stream.h"
+#include "debug.h"
+
+typedef struct{
+  int type;
+  int code;
+  int value;
+  unsigned long long t;
+}edge_ev_s;
+
+static edge_fn edge_cb[NUM_GPIO];
+static void *edge_ctx[NUM_GPIO];
+static int edge_mask = 0;
+static volatile int edge_lvl = 0;
+
+static int edge_fd[NUM_GPIO];
+static int edge_v2_fd = -1;
+static unsigned edge_line_seq[NUM_GPIO];
+static volatile unsigned edge_lost_cnt[NUM_GPIO];
+static int edge_running = 0;
+static volatile int edge_quit = 0;
+static pthread_t edge_thread;
+
+/* single producer (edge thread), single consumer (main loop) */
+static edge_ev_s edge_q[EDGE_QUEUE];
+static volatile unsigned edge_head = 0;
+static volatile unsigned edge_tail = 0;
+static volatile unsigned edge_overrun = 0;
+
+static int edge_request_v2(int chip);
+static int edge_request_v1(int chip);
+static void *edge_chardev_v2(void *arg);
+static void *edge_chardev(void *arg);
+static void *edge_sampler(void *arg);
+static unsigned long long edge_ts_us(unsigned long long ns, long long rt_offs);
+
+
+/* register "fn" to be called for every edge on "pin", the pin is set up as
+ * an input.  A pin can only have one owner.  With no "fn" the pin is only
+ * followed for edge_level().
+ */
+int edge_add(int pin, edge_fn fn, void *ctx) {
+
+  if ((pin < 0) || (pin >= NUM_GPIO) || edge_running) {
+    return(-1);
+  }
+  if (edge_mask & (1 << pin)) {
+    return(-1);
+  }
+  gpio_pincfg(pin, GPIO_IN, NULL);
+
+  edge_cb[pin] = fn;
+  edge_ctx[pin] = ctx;
+  edge_mask |= 1 << pin;
+
+  return(0);
+}
+
+
+/* last level seen on an edge captured pin */
+int edge_level(int pin) {
+
+  return((edge_lvl >> pin) & 1);
+}
+
+
+/* start watching the registered pins, nothing is started without pins */
+int edge_start(void) {
+
+  void *(*fn)(void *) = edge_sampler;
+  struct sched_param sp;
+  int chip;
+  int i;
+
+  if (!edge_mask || edge_running) {
+    return(0);
+  }
+
+  for (i=0; i<NUM_GPIO; i++) {
+    edge_fd[i] = -1;
+  }
+  edge_v2_fd = -1;
+
+  edge_lvl = gpio_levels() & edge_mask;
+
+  if ((chip = open(EDGE_CHIP, O_RDONLY)) >= 0) {
+    if (edge_request_v2(chip) == 0) {
+      fn = edge_chardev_v2;
+    }
+    else if (edge_request_v1(chip) == 0) {
+      fn = edge_chardev;
+    }
+    close(chip);
+  }
+  if ((fn == edge_sampler) && debug_on()) {
+    printf("Edge: %s not usable, sampling instead\n", EDGE_CHIP);
+  }
+
+  edge_quit = 0;
+  if (pthread_create(&edge_thread, NULL, fn, NULL)) {
+    perror("edge thread");
+    return(-1);
+  }
+  edge_running = 1;
+
+  /* counts and protocol timing should survive a busy CPU, if we may */
+  memset(&sp, 0, sizeof(sp));
+  sp.sched_priority = EDGE_PRIORITY;
+  if (pthread_setschedparam(edge_thread, SCHED_FIFO, &sp) && debug_on()) {
+    printf("Edge: no realtime priority, running as a normal thread\n");
+  }
+
+  if (debug_on()) {
+    printf("Edge capture on %08x using %s\n", edge_mask,
+           (fn == edge_sampler) ? "level sampling" : EDGE_CHIP);
+  }
+
+  return(1);
+}
+
+
+/* all pins as one line request, events from every pin then come through
+ * one queue in order and carry sequence numbers that show any the kernel
+ * had to drop
+ */
+static int edge_request_v2(int chip) {
+
+  struct gpio_v2_line_request req;
+  struct gpio_v2_line_values vals;
+  int i, n = 0;
+
+  memset(&req, 0, sizeof(req));
+  for (i=0; i<NUM_GPIO; i++) {
+    if (edge_mask & (1 << i)) {
+      req.offsets[n++] = i;
+    }
+  }
+  req.num_lines = n;
+  strcpy(req.consumer, "pikeyd");
+  req.config.flags = GPIO_V2_LINE_FLAG_INPUT | GPIO_V2_LINE_FLAG_EDGE_RISING |
+                     GPIO_V2_LINE_FLAG_EDGE_FALLING;
+  req.event_buffer_size = EDGE_KBUF;
+
+  if (ioctl(chip, GPIO_V2_GET_LINE_IOCTL, &req) < 0) {
+    return(-1);
+  }
+  edge_v2_fd = req.fd;
+
+  vals.mask = (1ULL << n) - 1;
+  vals.bits = 0;
+  if (ioctl(edge_v2_fd, GPIO_V2_LINE_GET_VALUES_IOCTL, &vals) == 0) {
+    for (i=0; i<n; i++) {
+      edge_lvl = (edge_lvl & ~(1 << req.offsets[i])) |
+                 (((vals.bits >> i) & 1) << req.offsets[i]);
+    }
+  }
+
+  return(0);
+}
+
+
+/* older kernels, one event request per pin */
+static int edge_request_v1(int chip) {
+
+  struct gpioevent_request req;
+  struct gpiohandle_data data;
+  int i;
+
+  for (i=0; i<NUM_GPIO; i++) {
+    if (!(edge_mask & (1 << i))) {
+      continue;
+    }
+    memset(&req, 0, sizeof(req));
+    req.lineoffset = i;
+    req.handleflags = GPIOHANDLE_REQUEST_INPUT;
+    req.eventflags = GPIOEVENT_REQUEST_BOTH_EDGES;
+    strcpy(req.consumer_label, "pikeyd");
+    if (ioctl(chip, GPIO_GET_LINEEVENT_IOCTL, &req) < 0) {
+      for (i=0; i<NUM_GPIO; i++) {
+        if (edge_fd[i] >= 0) {
+          close(edge_fd[i]);
+          edge_fd[i] = -1;
+        }
+      }
+      return(-1);
+    }
+    edge_fd[i] = req.fd;
+    if (ioctl(req.fd, GPIOHANDLE_GET_LINE_VALUES_IOCTL, &data) == 0) {
+      edge_lvl = (edge_lvl & ~(1 << i)) | ((data.values[0] & 1) << i);
+    }
+  }
+
+  return(0);
+}
+
+
+void edge_stop(void) {
+
+  int i;
+
+  if (!edge_running) {
+    return;
+  }
+  edge_quit = 1;
+  pthread_join(edge_thread, NULL);
+  edge_running = 0;
+
+  for (i=0; i<NUM_GPIO; i++) {
+    if (edge_fd[i] >= 0) {
+      close(edge_fd[i]);
+      edge_fd[i] = -1;
+    }
+  }
+  if (edge_v2_fd >= 0) {
+    close(edge_v2_fd);
+    edge_v2_fd = -1;
+  }
+}
+
+
+/* edges the kernel dropped on "pin" because we didn't read them in time,
+ * only known with the v2 character device
+ */
+unsigned edge_lost(int pin) {
+
+  return(edge_lost_cnt[pin]);
+}
+
+
+/* v2 character device: every pin through one queue, already in order */
+static void *edge_chardev_v2(void *arg) {
+
+  struct gpio_v2_line_event ev[64];
+  struct pollfd pfd;
+  int i, cnt, pin, level;
+
+  pfd.fd = edge_v2_fd;
+  pfd.events = POLLIN;
+
+  while (!edge_quit) {
+
+    if (poll(&pfd, 1, 100) <= 0) {
+      continue;
+    }
+    cnt = read(edge_v2_fd, ev, sizeof(ev));
+    if (cnt <= 0) {
+      continue;
+    }
+    cnt /= sizeof(ev[0]);
+
+    for (i=0; i<cnt; i++) {
+      pin = ev[i].offset;
+      if ((pin < 0) || (pin >= NUM_GPIO)) {
+        continue;
+      }
+      if (ev[i].line_seqno != edge_line_seq[pin] + 1) {
+        edge_lost_cnt[pin] += ev[i].line_seqno - edge_line_seq[pin] - 1;
+      }
+      edge_line_seq[pin] = ev[i].line_seqno;
+
+      level = (ev[i].id == GPIO_V2_LINE_EVENT_RISING_EDGE);
+      edge_lvl = (edge_lvl & ~(1 << pin)) | (level << pin);
+      if (edge_cb[pin]) {
+        edge_cb[pin](edge_ctx[pin], pin, level, ev[i].timestamp_ns / 1000);
+      }
+    }
+  }
+
+  return(NULL);
+}
+
+
+/* interrupt driven edges from the GPIO character device.  Every pin has
+ * its own event queue, so whatever is waiting on all of them is merged
+ * into time order before the handlers see it.
+ */
+static void *edge_chardev(void *arg) {
+
+  struct pollfd pfd[NUM_GPIO];
+  int pin[NUM_GPIO];
+  struct gpioevent_data ev[16];
+  static struct { unsigned long long t; int pin, level; } batch[NUM_GPIO * 16], tmp;
+  struct timespec mono, real;
+  long long rt_offs;
+  int n = 0, nb;
+  int i, j, cnt;
+
+  /* older kernels stamp events with CLOCK_REALTIME */
+  clock_gettime(CLOCK_MONOTONIC, &mono);
+  clock_gettime(CLOCK_REALTIME, &real);
+  rt_offs = (mono.tv_sec - real.tv_sec) * 1000000000LL + (mono.tv_nsec - real.tv_nsec);
+
+  for (i=0; i<NUM_GPIO; i++) {
+    if (edge_fd[i] >= 0) {
+      pfd[n].fd = edge_fd[i];
+      pfd[n].events = POLLIN;
+      pin[n] = i;
+      n++;
+    }
+  }
+
+  while (!edge_quit) {
+
+    if (poll(pfd, n, 100) <= 0) {
+      continue;
+    }
+
+    nb = 0;
+    for (i=0; i<n; i++) {
+      if (!(pfd[i].revents & POLLIN)) {
+        continue;
+      }
+      cnt = read(pfd[i].fd, ev, sizeof(ev));
+      if (cnt <= 0) {
+        continue;
+      }
+      cnt /= sizeof(ev[0]);
+
+      for (j=0; j<cnt; j++) {
+        batch[nb].t = edge_ts_us(ev[j].timestamp, rt_offs);
+        batch[nb].pin = pin[i];
+        batch[nb].level = (ev[j].id == GPIOEVENT_EVENT_RISING_EDGE);
+        nb++;
+      }
+    }
+
+    /* insertion sort, each pin's events are already in order */
+    for (i=1; i<nb; i++) {
+      tmp = batch[i];
+      for (j=i; (j > 0) && (batch[j-1].t > tmp.t); j--) {
+        batch[j] = batch[j-1];
+      }
+      batch[j] = tmp;
+    }
+
+    for (i=0; i<nb; i++) {
+      edge_lvl = (edge_lvl & ~(1 << batch[i].pin)) | (batch[i].level << batch[i].pin);
+      if (edge_cb[batch[i].pin]) {
+        edge_cb[batch[i].pin](edge_ctx[batch[i].pin], batch[i].pin, batch[i].level, batch[i].t);
+      }
+    }
+  }
+
+  return(NULL);
+}
+
+
+/* kernel event time in us on the CLOCK_MONOTONIC time base */
+static unsigned long long edge_ts_us(unsigned long long ns, long long rt_offs) {
+
+  unsigned long long now = gpio_time_us() * 1000ULL;
+
+  /* a realtime stamp is decades away from the monotonic clock */
+  if ((ns > now) && (ns - now > 86400000000000ULL)) {
+    ns += rt_offs;
+  }
+
+  return(ns / 1000);
+}
+
+
+/* fall back for kernels without the character device: read the level
+ * register at a fixed rate and report every pin that changed
+ */
+static void *edge_sampler(void *arg) {
+
+  struct timespec next;
+  unsigned long long t;
+  int lvl, diff, i;
+
+  clock_gettime(CLOCK_MONOTONIC, &next);
+
+  while (!edge_quit) {
+
+    lvl = gpio_levels() & edge_mask;
+    diff = lvl ^ edge_lvl;
+
+    if (diff) {
+      t = gpio_time_us();
+      for (i=0; i<NUM_GPIO; i++) {
+        if (diff & (1 << i)) {
+          edge_lvl ^= 1 << i;
+          if (edge_cb[i]) {
+            edge_cb[i](edge_ctx[i], i, (lvl >> i) & 1, t);
+          }
+        }
+      }
+    }
+
+    next.tv_nsec += EDGE_SAMPLE_US * 1000;
+    if (next.tv_nsec >= 1000000000) {
+      next.tv_nsec -= 1000000000;
+      next.tv_sec++;
+    }
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+  }
+
+  return(NULL);
+}
+
+
+/* queue an input event for the main loop, called from edge handlers */
+int edge_post(int type, int code, int value, unsigned long long t) {
+
+  unsigned head = edge_head;
+
+  if (head - edge_tail >= EDGE_QUEUE) {
+    edge_overrun++;
+    return(-1);
+  }
+  edge_q[head % EDGE_QUEUE].type = type;
+  edge_q[head % EDGE_QUEUE].code = code;
+  edge_q[head % EDGE_QUEUE].value = value;
+  edge_q[head % EDGE_QUEUE].t = t;
+  __sync_synchronize();
+  edge_head = head + 1;
+
+  return(0);
+}
+
+
+/* send everything the edge handlers queued, relative moves on the same
+ * axis that arrived together are sent as one event
+ */
+void edge_dispatch(void) {
+
+  edge_ev_s *ev;
+  unsigned tail = edge_tail;
+  unsigned head = edge_head;
+  int rel_code = -1, rel_sum = 0;
+  unsigned long long rel_t = 0;
+  static unsigned overrun_seen = 0;
+
+  if ((edge_overrun != overrun_seen) && debug_on()) {
+    printf("Edge: %u events dropped, main loop fell behind\n", edge_overrun - overrun_seen);
+    overrun_seen = edge_overrun;
+  }
+
+  __sync_synchronize();
+
+  for (; tail != head; tail++) {
+    ev = &edge_q[tail % EDGE_QUEUE];
+
+    if ((rel_code >= 0) && ((ev->type != EV_REL) || (ev->code != rel_code))) {
+      uinput_stamp(rel_t);
+      sendRelAxis(rel_code, rel_sum);
+      rel_code = -1;
+    }
+
+    if (ev->type == EV_REL) {
+      if (rel_code < 0) {
+        rel_code = ev->code;
+        rel_sum = 0;
+        rel_t = ev->t;
+      }
+      rel_sum += ev->value;
+    }
+    else if (ev->type == EV_KEY) {
+      uinput_stamp(ev->t);
+      keystate_set(ev->code, ev->value, ev->t);
+      stream_event(STREAM_KEY, STREAM_EDGE, 0, STREAM_NO_PIN, ev->code, ev->value,
+                   ev->value, ev->t);
+      sendKey(ev->code, ev->value);
+    }
+  }
+  if (rel_code >= 0) {
+    uinput_stamp(rel_t);
+    sendRelAxis(rel_code, rel_sum);
+  }
+
+  __sync_synchronize();
+  edge_tail = tail;
+}
+
+
+unsigned edge_overruns(void) {
+
+  return(edge_overrun);
+}
@@ -0,0 +1,48 @@
+/**** edge.h *******************************/
+/*   Universal RPi GPIO keyboard daemon    */
+/*                                         */
+/* timestamped GPIO edge capture           */
+/*******************************************/
+
+/*
+   This file is part of the Universal Raspberry Pi GPIO keyboard daemon.
+
+   This is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   The software is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with the GNU C Library; if not, write to the Free
+   Software Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+   02111-1307 USA.  
+*/
+
+#ifndef _EDGE_H_
+#define _EDGE_H_
+
+#define EDGE_CHIP       "/dev/gpiochip0"
+#define EDGE_SAMPLE_US  20              /* sampler period without chardev */
+#define EDGE_QUEUE      256             /* events waiting for the main loop */
+#define EDGE_KBUF       1024            /* edges the kernel may hold for us */
+#define EDGE_PRIORITY   50              /* SCHED_FIFO priority of the thread */
+
+/* called from the edge thread for every edge on a registered pin,
+ * "t" is the CLOCK_MONOTONIC time of the edge in us */
+typedef void (*edge_fn)(void *ctx, int pin, int level, unsigned long long t);
+
+int edge_add(int pin, edge_fn fn, void *ctx);
+int edge_level(int pin);
+int edge_start(void);
+void edge_stop(void);
+int edge_post(int type, int code, int value, unsigned long long t);
+void edge_dispatch(void);
+unsigned edge_overruns(void);
+unsigned edge_lost(int pin);
+
+#endif
@@ -0,0 +1,190 @@
+/**** encoder.c ****************************/
+/*   Universal RPi GPIO keyboard daemon    */
+/*                                         */
+/* quadrature rotary encoders              */
+/*******************************************/
+
+/*
+   This file is part of the Universal Raspberry Pi GPIO keyboard daemon.
+
+   This is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   The software is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with the GNU C Library; if not, write to the Free
+   Software Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+   02111-1307 USA.  
+*/
+
+
+/* Quadrature decoding for rotary encoders and spinners.  Both contacts are
+ * edge captured, every edge is run through a transition table and whole
+ * detents are queued as either a key press/release or a relative move.
+ * Edges the kernel dropped, and a contact "changing" to the level it
+ * already had, mean transitions were lost; they are counted and reported
+ * with -D.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <linux/input.h>
+#include "config.h"
+#include "gpio.h"
+#include "edge.h"
+#include "encoder.h"
+#include "debug.h"
+
+typedef struct{
+  char *name;
+  int pin_a, pin_b;
+  int state;                    /* last A/B as (A << 1) | B */
+  int acc;                      /* transitions since the last detent */
+  int steps;
+  int type;                     /* EV_KEY or EV_REL */
+  int code[2];                  /* clockwise, counter clockwise */
+  volatile unsigned missed;
+  unsigned reported;
+  unsigned long long t_report;
+}encoder_s;
+
+/* indexed by (old state << 2) | new state, clockwise is 00 10 11 01;
+ * an edge changes one contact, so the diagonals never come up */
+static const signed char enc_table[16] = {
+   0, -1,  1,  0,
+   1,  0,  0, -1,
+  -1,  0,  0,  1,
+   0,  1, -1,  0
+};
+
+static encoder_s enc[MAX_ENCODERS];
+static int enc_count = 0;
+
+static void encoder_edge(void *ctx, int pin, int level, unsigned long long t);
+static void encoder_step(encoder_s *e, int dir, unsigned long long t);
+
+
+/* add an encoder on "pin_a"/"pin_b".  For EV_KEY the codes are the keys
+ * for each direction, for EV_REL "code_cw" is the axis and clockwise moves
+ * it positive.  Returns the encoder number or -1.
+ */
+int encoder_add(const char *name, int pin_a, int pin_b, int type,
+                int code_cw, int code_ccw, int steps) {
+
+  encoder_s *e;
+
+  if (enc_count >= MAX_ENCODERS) {
+    return(-1);
+  }
+  e = &enc[enc_count];
+  memset(e, 0, sizeof(encoder_s));
+
+  e->name = strdup(name);
+  e->pin_a = pin_a;
+  e->pin_b = pin_b;
+  e->type = type;
+  e->code[0] = code_cw;
+  e->code[1] = code_ccw;
+  e->steps = (steps > 0) ? steps : ENC_STEPS;
+
+  if (edge_add(pin_a, encoder_edge, e) < 0) {
+    return(-1);
+  }
+  if (edge_add(pin_b, encoder_edge, e) < 0) {
+    return(-1);
+  }
+  e->state = -1;
+
+  return(enc_count++);
+}
+
+
+int encoder_num(void) {
+
+  return(enc_count);
+}
+
+
+/* called on the edge thread */
+static void encoder_edge(void *ctx, int pin, int level, unsigned long long t) {
+
+  encoder_s *e = (encoder_s *) ctx;
+  int bit = (pin == e->pin_a) ? 2 : 1;
+  int state;
+  int move;
+
+  /* first edge, the state before it is the other contact as it is now */
+  if (e->state < 0) {
+    e->state = (edge_level(e->pin_a) << 1) | edge_level(e->pin_b);
+    e->state = level ? (e->state & ~bit) : (e->state | bit);
+  }
+
+  state = level ? (e->state | bit) : (e->state & ~bit);
+
+  /* same level twice, the opposite edge went missing */
+  if (state == e->state) {
+    e->missed++;
+    return;
+  }
+
+  move = enc_table[(e->state << 2) | state];
+  e->state = state;
+
+  e->acc += move;
+  if (e->acc >= e->steps) {
+    e->acc -= e->steps;
+    encoder_step(e, 1, t);
+  }
+  else if (e->acc <= -e->steps) {
+    e->acc += e->steps;
+    encoder_step(e, -1, t);
+  }
+}
+
+
+static void encoder_step(encoder_s *e, int dir, unsigned long long t) {
+
+  int code;
+
+  if (e->type == EV_REL) {
+    edge_post(EV_REL, e->code[0], dir, t);
+  }
+  else {
+    code = e->code[dir > 0 ? 0 : 1];
+    edge_post(EV_KEY, code, 1, t);
+    edge_post(EV_KEY, code, 0, t);
+  }
+}
+
+
+/* called from the main loop, prints missed transition counts at most once
+ * a second per encoder while they are going up
+ */
+void encoder_report(void) {
+
+  unsigned long long now;
+  unsigned missed;
+  int i;
+
+  if (!debug_on()) {
+    return;
+  }
+  now = gpio_time_us();
+
+  for (i=0; i<enc_count; i++) {
+    missed = edge_lost(enc[i].pin_a) + edge_lost(enc[i].pin_b) + enc[i].missed;
+    if ((missed != enc[i].reported) && (now - enc[i].t_report >= 1000000)) {
+      printf("%s: %u missed transitions (%u since last report)\n",
+             enc[i].name, missed, missed - enc[i].reported);
+      enc[i].reported = missed;
+      enc[i].t_report = now;
+    }
+  }
+}
@@ -0,0 +1,38 @@
+/**** encoder.h ****************************/
+/*   Universal RPi GPIO keyboard daemon    */
+/*                                         */
+/* quadrature rotary encoders              */
+/*******************************************/
+
+/*
+   This file is part of the Universal Raspberry Pi GPIO keyboard daemon.
+
+   This is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   The software is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with the GNU C Library; if not, write to the Free
+   Software Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+   02111-1307 USA.  
+*/
+
+
+#ifndef _ENCODER_H_
+#define _ENCODER_H_
+
+#define MAX_ENCODERS    8
+#define ENC_STEPS       4       /* quadrature transitions per detent */
+
+int encoder_add(const char *name, int pin_a, int pin_b, int type,
+                int code_cw, int code_ccw, int steps);
+int encoder_num(void);
+void encoder_report(void);
+
+#endif
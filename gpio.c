@@ -30,8 +30,13 @@
 #include <fcntl.h>
 #include <sys/mman.h>
 #include <unistd.h>
+#include <time.h>
+#include <pthread.h>
 #include "gpio.h"
 #include "config.h"
+#include "uinput.h"
+#include "keystate.h"
+#include "stream.h"
 #include "debug.h"
 
 #define BOUNCE_TIME 2
@@ -63,6 +68,7 @@ struct joydata_struct
 #define GPIO_CLR *(GPIO+10)	/* clears GPIO bits for mask */
 #define GPIO_PUD *(GPIO+37)	/* GPIO Pull up/down register */
 #define GPIO_PUDCLK *(GPIO+38)	/* GPIO Pull up/down clock register */
+#define GPIO_LEV *(GPIO+GPIO_ADDR_OFFSET)	/* GPIO pin level register */
 
 /* GPIO pin ALT function set bits */
 #define	GPIO_ALT_INPT		0b000	/* Pin as an input */
@@ -184,53 +190,69 @@ int gpio_pincfg(int pin, char flg, int *mask) {
 /* set the internal pull resisters for a pin */
 int gpio_pull(int pin, int mode) {
 
-  if (GpioFlags[pin] == GPIO_IN) {
+  return(gpio_pull_mask(1 << pin, mode) ? 1 : 0);
+}
 
-    GPIO_PUD = mode & 3;
-    usleep(5);
-    GPIO_PUDCLK = 1 << (pin & 31);
-    usleep(5);
 
-    GPIO_PUD = 0;
-    usleep(5);
-    GPIO_PUDCLK = 0;
-    usleep(5);
+/* Set the internal pull resisters for all pins in "mask" with a single
+ * GPPUD/GPPUDCLK sequence.  Only pins configured for input are changed,
+ * the mask of pins actually set is returned.
+ */
+int gpio_pull_mask(int mask, int mode) {
 
-  }
-  else {
-    if (debug_lvl() >= DEBUG_GPIO) {
-      char str[32];
+  int pin, in_mask = 0;
+
+  for (pin=0; pin<GPIO_NUM; pin++) {
+    if (mask & (1 << pin)) {
+      if (GpioFlags[pin] == GPIO_IN) {
+        in_mask |= 1 << pin;
+      }
+      else if (debug_lvl() >= DEBUG_GPIO) {
+        char str[32];
 
-      switch(mode) {
-        case PUD_OFF:
-          strcpy(str, "floating");
-          break;
+        switch(mode) {
+          case PUD_OFF:
+            strcpy(str, "floating");
+            break;
 
-        case PUD_DOWN:
-          strcpy(str, "pull down");
-          break;
+          case PUD_DOWN:
+            strcpy(str, "pull down");
+            break;
 
-        case PUD_UP:
-          strcpy(str, "pull up");
-          break;
+          case PUD_UP:
+            strcpy(str, "pull up");
+            break;
 
-        default:
-          strcpy(str, "UNKNOWN");
+          default:
+            strcpy(str, "UNKNOWN");
+        }
+        printf("GPIO%02d not set for %s as not configured for INPUT\n", pin, str);
       }
-      printf("GPIO%02d not set for %s as not configured for INPUT\n", pin, str);
     }
-    return(0);
   }
 
-  return(1);
+  if (in_mask) {
+    GPIO_PUD = mode & 3;
+    usleep(5);
+    GPIO_PUDCLK = in_mask;
+    usleep(5);
+
+    GPIO_PUD = 0;
+    usleep(5);
+    GPIO_PUDCLK = 0;
+    usleep(5);
+  }
+
+  return(in_mask);
 }
 
 
 void gpio_poll(int grp) {
 
-  int i;
+  int i, chg, src;
   int new_gpio;
   mat_grp_s *mat_grp;
+  gpio_key_s *ev;
 
   mat_grp = get_matgrp(grp);
 
@@ -248,9 +270,24 @@ void gpio_poll(int grp) {
     GPIO_SET = 1 << mat_grp->gpio;
   }
 
+  src = (mat_grp->gpio == -1) ? STREAM_GPIO : STREAM_MATRIX;
+
   if (new_gpio != mat_grp->last_gpio) {
+    if (!mat_grp->cur_gpio) {
+      mat_grp->t_change = gpio_time_us();
+    }
     mat_grp->bounce_cnt = 0;
     mat_grp->cur_gpio |= new_gpio ^ mat_grp->last_gpio;
+
+    if (stream_active()) {
+      chg = new_gpio ^ mat_grp->last_gpio;
+      for (i=0; chg; i++, chg >>= 1) {
+        if (chg & 1) {
+          stream_event(STREAM_RAW, src, grp, i, 0, !(new_gpio & (1<<i)),
+                       (mat_grp->stable_down >> i) & 1, gpio_time_us());
+        }
+      }
+    }
   }
   mat_grp->last_gpio = new_gpio;
 
@@ -260,6 +297,7 @@ void gpio_poll(int grp) {
 
   if (mat_grp->bounce_cnt >= BOUNCE_TIME) {
 
+    uinput_stamp(mat_grp->t_change);
     for (i=0; i<GPIO_NUM; i++) {
 
       /* handle IRQs */
@@ -272,8 +310,25 @@ void gpio_poll(int grp) {
       /* handle GPIO buttons */
       if (mat_grp->cur_gpio & (1<<i)) {
 
-        /* only send a key on press (pin low) */
-        if (!(new_gpio & (1<<i))) {
+        for (ev = mat_grp->gpio_key[i]; ev; ev = ev->next) {
+          keystate_set(ev->key, !(new_gpio & (1<<i)), mat_grp->t_change);
+        }
+        /* pins read low when down: a pin bit equal to its down bit changed */
+        if (((new_gpio >> i) & 1) == ((mat_grp->stable_down >> i) & 1)) {
+          mat_grp->stable_down ^= 1 << i;
+          for (ev = mat_grp->gpio_key[i]; ev; ev = ev->next) {
+            stream_event(STREAM_KEY, src, grp, i, ev->key, !(new_gpio & (1<<i)),
+                         !(new_gpio & (1<<i)), mat_grp->t_change);
+          }
+
+          /* held keys follow the debounced state, a glitch is no press */
+          if (uinput_holding()) {
+            send_gpio_state(grp, i, !(new_gpio & (1<<i)));
+          }
+        }
+
+        /* otherwise only send a key on press (pin low) */
+        if (!uinput_holding() && !(new_gpio & (1<<i))) {
           send_gpio_keys(grp, i);
         }
       }
@@ -291,6 +346,65 @@ void gpio_poll(int grp) {
 }
 
 
+/* Free an I2C bus where a slave is holding SDA low part way through a byte.
+ * The pins are borrowed from the I2C controller, SCL is clocked up to nine
+ * times until the slave lets go of SDA, a STOP is generated and the pins are
+ * handed back to their previous function.  Returns 1 when SDA is free.
+ */
+int gpio_i2c_recover(int scl, int sda) {
+
+  static pthread_mutex_t fsel_lock = PTHREAD_MUTEX_INITIALIZER;
+  unsigned fsel_scl, fsel_sda;
+  int i, ok;
+
+  if ((scl < 0) || (scl >= GPIO_NUM) || (sda < 0) || (sda >= GPIO_NUM)) {
+    return(0);
+  }
+
+  /* SCL and SDA pairs of different buses can share a function register */
+  pthread_mutex_lock(&fsel_lock);
+
+  fsel_scl = *(GPIO+(scl/10));
+  fsel_sda = *(GPIO+(sda/10));
+
+  /* SDA is left to the pull-up, we only ever drive SCL */
+  INP_GPIO(sda);
+  GPIO_SET = 1 << scl;
+  INP_GPIO(scl);
+  OUT_GPIO(scl);
+
+  for (i=0; (i < 9) && !(GPIO_LEV & (1 << sda)); i++) {
+    GPIO_CLR = 1 << scl;
+    usleep(5);
+    GPIO_SET = 1 << scl;
+    usleep(5);
+  }
+
+  /* STOP condition: SDA rises while SCL is high */
+  GPIO_CLR = 1 << scl;
+  GPIO_CLR = 1 << sda;
+  OUT_GPIO(sda);
+  usleep(5);
+  GPIO_SET = 1 << scl;
+  usleep(5);
+  INP_GPIO(sda);
+  usleep(5);
+
+  ok = (GPIO_LEV & (1 << sda)) ? 1 : 0;
+
+  *(GPIO+(sda/10)) = fsel_sda;
+  *(GPIO+(scl/10)) = fsel_scl;
+
+  pthread_mutex_unlock(&fsel_lock);
+
+  if (debug_lvl() >= DEBUG_GPIO) {
+    printf("I2C recovery on GPIO%02d/GPIO%02d: %d clocks, SDA %s\n", scl, sda, i, ok?"free":"stuck");
+  }
+
+  return(ok);
+}
+
+
 void force_repeat(void) {
 
   KeyRepeat = 1;
@@ -301,6 +415,23 @@ void force_repeat(void) {
 
 void handle_repeat(int grp, int gpio_state) {
 
+  mat_grp_s *mat_grp;
+
+  mat_grp = get_matgrp(grp);
+  key_repeat(mat_grp->key_rpt, mat_grp->rpt_flg, &mat_grp->prev_gpio,
+             gpio_state, NUM_GPIO, send_gpio_keys, grp);
+
+  return;
+}
+
+
+/* Key repeat for a set of pins, shared by the GPIO groups and expanders.
+ * "state" has a bit set for every pressed pin and we get called about
+ * every 4ms; "send" emits the keys of pin "i" for device "id".
+ */
+void key_repeat(keyrpt_s *key_rpt, int rpt_flg, int *prev_state, int state,
+                int npins, int (*send)(int id, int pin), int id) {
+
   /* key repeat metrics: release after 80ms, press after 200ms, release after 40ms, press after 40ms */
   const struct {
     int time[4];
@@ -313,37 +444,40 @@ void handle_repeat(int grp, int gpio_state) {
   };
 
   int i, g;
-  mat_grp_s *mat_grp;
 
-  mat_grp = get_matgrp(grp);
+  /* held keys are repeated by the kernel */
+  if (uinput_holding()) {
+    return;
+  }
 
-  g = gpio_state & mat_grp->prev_gpio;
-  mat_grp->prev_gpio = gpio_state;
+  g = state & *prev_state;
+  *prev_state = state;
 
-  for (i=0; i<NUM_GPIO; i++) {
-    if ((mat_grp->rpt_flg & (1<<i)) || KeyRepeat) {
+  for (i=0; i<npins; i++) {
+    if ((rpt_flg & (1<<i)) || KeyRepeat) {
       if (g & (1<<i)) {
 
         /* we get called about every 4ms */ 
-        mat_grp->key_rpt[i].t_now += 4;
+        key_rpt[i].t_now += 4;
 
-        if (mat_grp->key_rpt[i].idx == -1) {
-          mat_grp->key_rpt[i].idx = 0;
-          mat_grp->key_rpt[i].t_next = mat_grp->key_rpt[i].t_now + mxkey.time[mat_grp->key_rpt[i].idx];
-          mat_grp->key_rpt[i].t_now = 0;
+        if (key_rpt[i].idx == -1) {
+          key_rpt[i].idx = 0;
+          key_rpt[i].t_next = key_rpt[i].t_now + mxkey.time[key_rpt[i].idx];
+          key_rpt[i].t_now = 0;
         }
-        else if (mat_grp->key_rpt[i].t_now >= mat_grp->key_rpt[i].t_next) {
-          send_gpio_keys(grp, i);
-          mat_grp->key_rpt[i].idx = mxkey.next[mat_grp->key_rpt[i].idx];
-          mat_grp->key_rpt[i].t_next = mxkey.time[mat_grp->key_rpt[i].idx];
-          mat_grp->key_rpt[i].t_now = 0;
+        else if (key_rpt[i].t_now >= key_rpt[i].t_next) {
+          uinput_stamp(0);
+          send(id, i);
+          key_rpt[i].idx = mxkey.next[key_rpt[i].idx];
+          key_rpt[i].t_next = mxkey.time[key_rpt[i].idx];
+          key_rpt[i].t_now = 0;
         }
       }
       /* non-repeat state, reset repeat values */
       else {
-        mat_grp->key_rpt[i].idx = -1;
-        mat_grp->key_rpt[i].t_now = 0;
-        mat_grp->key_rpt[i].t_next = 0;
+        key_rpt[i].idx = -1;
+        key_rpt[i].t_now = 0;
+        key_rpt[i].t_next = 0;
       }
     }
   }
@@ -351,3 +485,20 @@ void handle_repeat(int grp, int gpio_state) {
   return;
 }
 
+
+/* raw level register, for threads that sample pins on their own */
+int gpio_levels(void) {
+
+  return(GPIO_LEV);
+}
+
+
+/* CLOCK_MONOTONIC time in microseconds, used to stamp input samples */
+unsigned long long gpio_time_us(void) {
+
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return(ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000);
+}
@@ -24,8 +24,10 @@
    02111-1307 USA.  
 */
 
-#ifndef _GPIO_H_
-#define _GPIO_H_
+#ifndef _PIKEYD_GPIO_H_
+#define _PIKEYD_GPIO_H_
+
+#include "config.h"
 
 #define GPIO_NUM	32
 #define GPIO_IN		'I'
@@ -39,8 +41,14 @@
 int gpio_init(void);
 int gpio_pincfg(int pin, char flg, int *mask);
 int gpio_pull(int pin, int mode);
+int gpio_pull_mask(int mask, int mode);
 void gpio_poll(int grp);
+int gpio_i2c_recover(int scl, int sda);
 void force_repeat(void);
+void key_repeat(keyrpt_s *key_rpt, int rpt_flg, int *prev_state, int state,
+                int npins, int (*send)(int id, int pin), int id);
+int gpio_levels(void);
+unsigned long long gpio_time_us(void);
 
 #endif
 
@@ -24,100 +24,627 @@
 */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <fcntl.h>
 #include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
 #include <linux/i2c-dev.h>
 #include <linux/i2c.h>
 #include "iic.h"
+#include "spi.h"
 #include "gpio.h"
+#include "config.h"
+#include "xio.h"
+#include "debug.h"
 
-static int fd=0;
-static char buffer[12];
-static const char devName[]="/dev/i2c-1";
+/* Every I2C adapter gets its own context and worker thread, so expanders
+ * spread over several buses are read in parallel.  The main loop only
+ * flags devices as pending; the bus worker does the actual transfers.
+ * A spidev node can be used as a bus too, for the SPI expander variants.
+ */
+typedef struct{
+  char name[32];                  /* adapter device, eg. /dev/i2c-1 */
+  int fd;
+  int spi;                        /* set for a spidev bus */
+  int addr;                       /* slave currently selected, -1 for none */
+  int scl, sda;                   /* GPIO pins for bus recovery, -1 if none */
+  char buffer[IIC_BUF_SIZE];
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  unsigned pending;               /* mask of XIO devices waiting for service */
+  unsigned quarantine;            /* mask of XIO devices taken off line */
+  unsigned poll;                  /* mask of XIO devices without INT line */
+  int budget;                     /* % of the bus polling may use */
+  int clock;                      /* bus clock in Hz */
+  int running;
+}iic_bus_s;
 
-int init_iic(void)
+/* per expander fault tracking, only touched by the owning bus worker */
+typedef struct{
+  unsigned errors;                /* total failed transfers */
+  int fails;                      /* consecutive failed transfers */
+  unsigned backoff;               /* current re-probe delay in ms */
+  unsigned next_probe;            /* time of next re-probe in ms */
+  int rate;                       /* polled samples/s, 0 if INT driven */
+  unsigned period;                /* poll period in us */
+  unsigned long long next_poll;   /* time of next poll in us */
+  unsigned samples;               /* successful polls since last report */
+}iic_dev_s;
+
+static iic_bus_s iic_bus[IIC_MAX_BUS];
+static int bus_count = 0;
+static iic_dev_s iic_dev[MAX_XIO_DEVS];
+
+static void iic_service(int xio, int polled);
+static void iic_fault(int xio, int bus);
+static void iic_recover_bus(int bus);
+static void iic_plan_polls(int bus);
+static void iic_report_polls(int bus, unsigned long long elapsed);
+static unsigned long long iic_us(void);
+static unsigned iic_ms(void);
+static void *iic_worker(void *arg);
+
+
+/* open (or find the already open) adapter "devName", returns the bus index */
+int iic_open_bus(const char *devName)
 {
-  if( (fd = open(devName, O_RDWR)) < 0 ){
-    perror(devName);
+  int i;
+  iic_bus_s *bus;
+  pthread_condattr_t attr;
+
+  for(i=0; i<bus_count; i++){
+    if( !strcmp(iic_bus[i].name, devName) ){
+      return i;
+    }
+  }
+
+  if(bus_count >= IIC_MAX_BUS){
+    printf("Too many I2C buses, %s not opened.\n", devName);
     return -1;
   }
-	
+
+  bus = &iic_bus[bus_count];
+  memset(bus, 0, sizeof(iic_bus_s));
+  strncpy(bus->name, devName, sizeof(bus->name)-1);
+  bus->addr = -1;
+  bus->budget = IIC_BUDGET;
+  bus->clock = IIC_CLOCK;
+
+  /* the Pi's own controllers have fixed pins we can recover with */
+  if( !strcmp(devName, "/dev/i2c-1") ){
+    bus->scl = 3;
+    bus->sda = 2;
+  }
+  else if( !strcmp(devName, "/dev/i2c-0") ){
+    bus->scl = 1;
+    bus->sda = 0;
+  }
+  else{
+    bus->scl = bus->sda = -1;
+  }
+
+  if( !strncmp(devName, "/dev/spidev", 11) ){
+    bus->spi = 1;
+    bus->clock = SPI_SPEED;
+    if( (bus->fd = spi_open(devName, SPI_SPEED)) < 0 ){
+      return -1;
+    }
+  }
+  else{
+    if( (bus->fd = open(devName, O_RDWR)) < 0 ){
+      perror(devName);
+      return -1;
+    }
+
+    /* a hung slave must not block the worker for long */
+    if( ioctl(bus->fd, I2C_TIMEOUT, IIC_TIMEOUT) < 0 ){
+      perror("I2C_TIMEOUT");
+    }
+    if( ioctl(bus->fd, I2C_RETRIES, IIC_RETRIES) < 0 ){
+      perror("I2C_RETRIES");
+    }
+  }
+
+  pthread_mutex_init(&bus->lock, NULL);
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&bus->cond, &attr);
+  pthread_condattr_destroy(&attr);
+
+  if (debug_lvl() >= DEBUG_IIC) {
+    printf("I2C bus %d is %s\n", bus_count, devName);
+  }
+
+  return bus_count++;
+}
+
+int iic_is_spi(int bus)
+{
+  return iic_bus[bus].spi;
+}
+
+/* set the GPIO pins used to clock a stuck bus free, -1 disables recovery */
+int iic_set_recovery(int bus, int scl, int sda)
+{
+  if( (bus < 0) || (bus >= bus_count) ){
+    return -1;
+  }
+  iic_bus[bus].scl = scl;
+  iic_bus[bus].sda = sda;
+  return 0;
+}
+
+/* share of the bus ("pct" percent of "clock" Hz) that polling may take,
+ * a clock of 0 keeps the default for the bus type */
+int iic_set_budget(int bus, int pct, int clock)
+{
+  if( (bus < 0) || (bus >= bus_count) ){
+    return -1;
+  }
+  iic_bus[bus].budget = pct;
+  if(clock > 0){
+    iic_bus[bus].clock = clock;
+  }
+  return 0;
+}
+
+/* have the bus worker read an expander "rate" times a second */
+int iic_set_poll(int xio, int rate)
+{
+  int chip_addr, regno, bus;
+  iodev_e type;
+
+  get_xio_parm(xio, &type, &bus, &chip_addr, &regno);
+  iic_dev[xio].rate = rate;
+  iic_bus[bus].poll |= 1 << xio;
+  return 0;
+}
+
+/* start one worker thread per open adapter */
+int init_iic(void)
+{
+  int i;
+
+  for(i=0; i<bus_count; i++){
+    iic_plan_polls(i);
+    iic_bus[i].running = 1;
+    if( pthread_create(&iic_bus[i].thread, NULL, iic_worker, &iic_bus[i]) ){
+      perror("I2C worker");
+      iic_bus[i].running = 0;
+      return -1;
+    }
+  }
+
   return 0;
 }
 
-int connect_iic(int devAddr)
+int connect_iic(int bus, int devAddr)
 {
   char errstr[80];
-  if ( ioctl(fd, I2C_SLAVE, devAddr) < 0 ){
+
+  /* the slave stays selected until another address is used on this bus */
+  if( iic_bus[bus].addr == devAddr ){
+    return 0;
+  }
+  if ( ioctl(iic_bus[bus].fd, I2C_SLAVE, devAddr) < 0 ){
     sprintf(errstr, "I2C address %02x connect", devAddr);
     perror(errstr);
+    iic_bus[bus].addr = -1;
     return -1;
   }  
+  iic_bus[bus].addr = devAddr;
   return 0;
 }
 
+/* hand the device over to its bus worker, falls back to reading it inline
+ * when the workers are not running */
 void poll_iic(int xio)
 {
-  int chip_addr, regno;
+  int chip_addr, regno, b;
   iodev_e type;
-  get_xio_parm(xio, &type, &chip_addr, &regno);
-  buffer[0] = regno;
-  connect_iic(chip_addr);
-  write(fd, buffer, 1);
-  read(fd, buffer, 1);
-  //printf("iic poll %d: %02x = %02x\n", xio, chip_addr, buffer[0]);
-  handle_iic_event(xio, buffer[0]);
-  //test_iic(chip_addr);
+  iic_bus_s *bus;
+
+  get_xio_parm(xio, &type, &b, &chip_addr, &regno);
+  bus = &iic_bus[b];
+
+  if(!bus->running){
+    iic_service(xio, 0);
+    return;
+  }
+
+  pthread_mutex_lock(&bus->lock);
+  bus->pending |= 1 << xio;
+  pthread_cond_signal(&bus->cond);
+  pthread_mutex_unlock(&bus->lock);
 }
 
-int write_iic(int devAddr, int regno, char *buf, int n)
+int write_iic(int bus, int devAddr, int regno, char *buf, int n)
 {
   int r;
-  connect_iic(devAddr);
-  buffer[0]=regno;
-  memcpy(&buffer[1], buf, n);
+  char *buffer = iic_bus[bus].buffer;
 
-  if( (r = write(fd, buffer, n+1)) < 0 ){
-    perror("iic write data");
+  if(iic_bus[bus].spi){
+    return spi_write_reg(iic_bus[bus].fd, devAddr, regno, buf, n);
+  }
+
+  if( n+1 > IIC_BUF_SIZE ){
+    printf("iic write of %d bytes too long\n", n);
+    return -1;
+  }
+  connect_iic(bus, devAddr);
+
+  /* devices without registers (regno < 0) just take the data */
+  if(regno < 0){
+    memcpy(buffer, buf, n);
+  }
+  else{
+    buffer[0]=regno;
+    memcpy(&buffer[1], buf, n);
+    n++;
+  }
+
+  if( (r = write(iic_bus[bus].fd, buffer, n)) < 0 ){
+    if (debug_lvl() >= DEBUG_IIC) {
+      perror("iic write data");
+    }
   }
   return r;
 }
 
+/* read "n" bytes starting at register "regno".  The register write and the
+ * read go out as one combined transfer, regno < 0 reads from wherever the
+ * device is already pointing (or from a device without registers).
+ */
+int read_iic(int bus, int devAddr, int regno, char *buf, int n)
+{
+  int r;
+  char reg = regno;
+  struct i2c_msg msg[2];
+  struct i2c_rdwr_ioctl_data xfer;
+
+  if(iic_bus[bus].spi){
+    return spi_read_reg(iic_bus[bus].fd, devAddr, regno, buf, n);
+  }
+
+  if(regno < 0){
+    connect_iic(bus, devAddr);
+    if( (r = read(iic_bus[bus].fd, buf, n)) < 0 ){
+      if (debug_lvl() >= DEBUG_IIC) {
+        perror("iic read data");
+      }
+    }
+    return r;
+  }
+
+  msg[0].addr = devAddr;
+  msg[0].flags = 0;
+  msg[0].len = 1;
+  msg[0].buf = (unsigned char *)&reg;
+  msg[1].addr = devAddr;
+  msg[1].flags = I2C_M_RD;
+  msg[1].len = n;
+  msg[1].buf = (unsigned char *)buf;
+  xfer.msgs = msg;
+  xfer.nmsgs = 2;
+
+  if( (r = ioctl(iic_bus[bus].fd, I2C_RDWR, &xfer)) < 0 ){
+    if (debug_lvl() >= DEBUG_IIC) {
+      perror("iic read register");
+    }
+    return r;
+  }
+  return n;
+}
+
 
-void test_iic(int devAddr, int regaddr)
+void test_iic(int bus, int devAddr, int regaddr)
 {
   int i,n;
+  char *buffer = iic_bus[bus].buffer;
+
+  if( (n = read_iic(bus, devAddr, regaddr, buffer, 11)) >= 0 ){
+    printf("Read %d bytes from %02x/%02x on %s\n",n, devAddr, regaddr, iic_bus[bus].name);
+    for(i=0;i<n;i++){
+      printf("  %02x", (unsigned char)buffer[i]);
+    }
+    printf("\n");
+  }
+  else{
+    perror("Error reading from i2c");
+  }
+}
 
-  buffer[0] = regaddr;
+void close_iic(void)
+{
+  int i;
 
-  connect_iic(devAddr);
+  for(i=0; i<bus_count; i++){
+    if(iic_bus[i].running){
+      pthread_mutex_lock(&iic_bus[i].lock);
+      iic_bus[i].running = 0;
+      pthread_cond_signal(&iic_bus[i].cond);
+      pthread_mutex_unlock(&iic_bus[i].lock);
+      pthread_join(iic_bus[i].thread, NULL);
+    }
+    if(iic_bus[i].fd > 0){
+      close(iic_bus[i].fd);
+    }
+  }
+  bus_count = 0;
+}
 
-  if( (n = write(fd, buffer, 1)) < 0 ){
-    perror("Error writing to i2c");
+/* number of failed transfers seen on an expander */
+unsigned iic_errors(int xio)
+{
+  return iic_dev[xio].errors;
+}
+
+/* read the expander inputs and pass the values on for key handling,
+ * polled devices use the plain read as there is no interrupt to capture */
+static void iic_service(int xio, int polled)
+{
+  int cap, val, bus;
+  iic_dev_s *dev = &iic_dev[xio];
+  xio_dev_s *xdev = get_xio(xio);
+  const xio_drv_s *drv = xio_driver(xdev->type);
+
+  bus = xdev->bus;
+
+  /* quarantined devices are left alone until their re-probe is due */
+  if( (iic_bus[bus].quarantine & (1 << xio)) &&
+      ((int)(iic_ms() - dev->next_probe) < 0) ){
+    return;
   }
-  else{
-    printf("Wrote %d bytes to device %02x on %s\n", n, devAddr, devName);
+
+  if(polled){
+    if( drv->read(xdev, &val) < 0 ){
+      iic_fault(xio, bus);
+      return;
+    }
+    cap = val;
+    dev->samples++;
   }
+  else if( drv->capture(xdev, &cap, &val) < 0 ){
+    iic_fault(xio, bus);
+    return;
+  }
+  dev->fails = 0;
 
-  if( (n = read(fd, buffer, 11)) < 0 ){
-    perror("Error reading from i2c");
+  if( iic_bus[bus].quarantine & (1 << xio) ){
+    printf("I2C device %02x on %s is back, reconfiguring.\n", xdev->addr, iic_bus[bus].name);
+    iic_bus[bus].quarantine &= ~(1 << xio);
+    dev->backoff = 0;
+    setup_xio(xio);
+  }
+
+  if (debug_lvl() >= DEBUG_IIC) {
+    printf("iic poll %d: %02x = %04x/%04x\n", xio, xdev->addr, cap, val);
+  }
+
+  /* the latched state first, so a tap released before we got here counts */
+  handle_iic_event(xio, cap);
+  if(val != cap){
+    handle_iic_event(xio, val);
+  }
+}
+
+/* count a failed transfer and take the device off line when it keeps failing */
+static void iic_fault(int xio, int bus)
+{
+  iic_dev_s *dev = &iic_dev[xio];
+
+  dev->errors++;
+  dev->fails++;
+
+  if( iic_bus[bus].quarantine & (1 << xio) ){
+    /* failed re-probe, wait longer next time */
+    dev->backoff *= 2;
+    if(dev->backoff > IIC_BACKOFF_MAX){
+      dev->backoff = IIC_BACKOFF_MAX;
+    }
+  }
+  else if(dev->fails >= IIC_FAIL_LIMIT){
+    printf("I2C device %02x on %s not responding (%u errors), quarantined.\n",
+           get_xio(xio)->addr, iic_bus[bus].name, dev->errors);
+    iic_bus[bus].quarantine |= 1 << xio;
+    dev->backoff = IIC_BACKOFF_MIN;
+    iic_recover_bus(bus);
   }
   else{
-    printf("Read %d bytes from %02x/%02x\n",n, devAddr, regaddr);
-    for(i=0;i<n;i++){
-      printf("  %02x", (unsigned char)buffer[i]);
+    return;
+  }
+  dev->next_probe = iic_ms() + dev->backoff;
+}
+
+/* try to clock out a slave that is holding SDA low */
+static void iic_recover_bus(int bus)
+{
+  if( (iic_bus[bus].scl < 0) || (iic_bus[bus].sda < 0) ){
+    return;
+  }
+  if( !gpio_i2c_recover(iic_bus[bus].scl, iic_bus[bus].sda) ){
+    printf("I2C bus %s: SDA still held low after recovery.\n", iic_bus[bus].name);
+  }
+  /* the adapter has to select the slave again */
+  iic_bus[bus].addr = -1;
+}
+
+/* Work out the poll periods for a bus.  Each read costs its bytes on the
+ * wire: 9 clocks each plus start and stop on I2C, 8 clocks each with nothing
+ * around them on SPI, at that bus's own clock.  If the requested rates use
+ * more than the budget they are all scaled back by the same factor.  The
+ * first polls are staggered over a period so reads spread across ticks.
+ */
+static void iic_plan_polls(int bus)
+{
+  iic_bus_s *b = &iic_bus[bus];
+  unsigned long long now = iic_us();
+  double load = 0, limit, scale = 1;
+  unsigned cost[MAX_XIO_DEVS];
+  unsigned p, bits;
+  int xio, n, cnt = 0;
+
+  for(xio=0, p=b->poll; p; xio++, p >>= 1){
+    if(p & 1){
+      bits = xio_driver(get_xio(xio)->type)->cost;
+      bits = b->spi ? bits * 8 : bits * 9 + 2;
+      cost[xio] = (bits * 1000000ULL + b->clock - 1) / b->clock;
+      load += (double)iic_dev[xio].rate * cost[xio];
+      cnt++;
     }
-    printf("\n");
+  }
+  if(!cnt){
+    return;
+  }
+
+  limit = b->budget * 10000.0; /* us of bus time per second */
+  if(load > limit){
+    scale = limit / load;
+  }
+
+  for(xio=0, n=0, p=b->poll; p; xio++, p >>= 1){
+    if(p & 1){
+      iic_dev[xio].rate *= scale;
+      if(iic_dev[xio].rate < 1){
+        iic_dev[xio].rate = 1;
+      }
+      iic_dev[xio].period = 1000000 / iic_dev[xio].rate;
+      iic_dev[xio].next_poll = now + (unsigned long long)iic_dev[xio].period * n / cnt;
+      iic_dev[xio].samples = 0;
+      printf("%s: polling %s at %d/s (%u us per read)\n", b->name, get_xio(xio)->name, iic_dev[xio].rate, cost[xio]);
+      n++;
+    }
+  }
+  if(scale < 1){
+    printf("%s: poll rates scaled to %d%% to stay inside the %d%% bus budget\n", b->name, (int)(scale * 100), b->budget);
   }
 }
 
-void close_iic(void)
+/* print the sample rate each polled device actually achieved */
+static void iic_report_polls(int bus, unsigned long long elapsed)
 {
-  if(fd){
-    close(fd);
+  unsigned p;
+  int xio;
+
+  for(xio=0, p=iic_bus[bus].poll; p; xio++, p >>= 1){
+    if(p & 1){
+      if (debug_on()) {
+        printf("%s: %s sampled at %.1f/s (target %d/s)\n", iic_bus[bus].name, get_xio(xio)->name,
+               iic_dev[xio].samples * 1000000.0 / elapsed, iic_dev[xio].rate);
+      }
+      iic_dev[xio].samples = 0;
+    }
   }
 }
 
+static unsigned long long iic_us(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+static unsigned iic_ms(void)
+{
+  return iic_us() / 1000;
+}
+
+static void *iic_worker(void *arg)
+{
+  iic_bus_s *bus = (iic_bus_s *)arg;
+  unsigned pending, polls, q, ms;
+  unsigned long long now, wake, report;
+  struct timespec ts;
+  int xio;
+
+  report = iic_us() + IIC_RATE_REPORT * 1000000ULL;
+
+  pthread_mutex_lock(&bus->lock);
+  while(bus->running){
+
+    now = iic_us();
+    ms = now / 1000;
+    wake = now + IIC_BACKOFF_MAX * 1000ULL;
+    polls = 0;
+
+    /* quarantined devices are re-probed even when no interrupt comes in */
+    for(xio=0, q=bus->quarantine & ~bus->poll; q; xio++, q >>= 1){
+      if(q & 1){
+        if( (int)(iic_dev[xio].next_probe - ms) <= 0 ){
+          bus->pending |= 1 << xio;
+        }
+        else if(now + (iic_dev[xio].next_probe - ms) * 1000ULL < wake){
+          wake = now + (iic_dev[xio].next_probe - ms) * 1000ULL;
+        }
+      }
+    }
+
+    /* polled devices due now, the rest set the next wake up */
+    for(xio=0, q=bus->poll; q; xio++, q >>= 1){
+      if(q & 1){
+        if(iic_dev[xio].next_poll <= now){
+          polls |= 1 << xio;
+          iic_dev[xio].next_poll += iic_dev[xio].period;
+          if(iic_dev[xio].next_poll <= now){
+            /* fell behind, don't try to catch up in a burst */
+            iic_dev[xio].next_poll = now + iic_dev[xio].period;
+          }
+        }
+        if(iic_dev[xio].next_poll < wake){
+          wake = iic_dev[xio].next_poll;
+        }
+      }
+    }
+
+    if(bus->poll && (now >= report)){
+      iic_report_polls(bus - iic_bus, now - report + IIC_RATE_REPORT * 1000000ULL);
+      report = now + IIC_RATE_REPORT * 1000000ULL;
+    }
+
+    if(!bus->pending && !polls){
+      if(bus->quarantine || bus->poll){
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        wake -= now;
+        ts.tv_sec += wake / 1000000;
+        ts.tv_nsec += (wake % 1000000) * 1000;
+        if(ts.tv_nsec >= 1000000000){
+          ts.tv_sec++;
+          ts.tv_nsec -= 1000000000;
+        }
+        pthread_cond_timedwait(&bus->cond, &bus->lock, &ts);
+      }
+      else{
+        pthread_cond_wait(&bus->cond, &bus->lock);
+      }
+      continue;
+    }
+    pending = bus->pending;
+    bus->pending = 0;
+    pthread_mutex_unlock(&bus->lock);
+
+    for(xio=0; pending; xio++, pending >>= 1){
+      if(pending & 1){
+        iic_service(xio, 0);
+      }
+    }
+    for(xio=0; polls; xio++, polls >>= 1){
+      if(polls & 1){
+        iic_service(xio, 1);
+      }
+    }
+
+    pthread_mutex_lock(&bus->lock);
+  }
+  pthread_mutex_unlock(&bus->lock);
+
+  return NULL;
+}
+
 /* don't use */
 #if 0
 iodev_e dev_type(int devAddr)
@@ -26,19 +26,51 @@
 #ifndef _IIC_H_
 #define _IIC_H_
 
+#define IIC_MAX_BUS     8               /* I2C adapters we can service */
+#define IIC_BUF_SIZE    64              /* per bus transfer buffer */
+#define IIC_DEFAULT_BUS "/dev/i2c-1"
+
+/* transaction limits handed to the adapter driver */
+#define IIC_TIMEOUT     2               /* I2C_TIMEOUT in 10ms units */
+#define IIC_RETRIES     1               /* I2C_RETRIES */
+
+/* fault isolation for misbehaving expanders */
+#define IIC_FAIL_LIMIT  3               /* consecutive errors before quarantine */
+#define IIC_BACKOFF_MIN 100             /* first re-probe delay in ms */
+#define IIC_BACKOFF_MAX 10000           /* re-probe delay ceiling in ms */
+
+/* polling of expanders without an interrupt line */
+#define IIC_CLOCK       100000          /* assumed bus clock in Hz */
+#define IIC_BUDGET      30              /* % of the bus polling may use */
+#define IIC_RATE_REPORT 10              /* seconds between rate reports */
+
 typedef enum{
   IO_UNK,
   IO_MCP23008,
   IO_MCP23017A, /* 16-pin chip is split into two 8-bit banks */
   IO_MCP23017B,
+  IO_PCF8574,   /* quasi-bidirectional, no register addressing */
+  IO_PCF8575,
+  IO_TCA9555,   /* 16-bit, sticky command byte */
+  IO_MCP23S08,  /* SPI versions of the MCP230xx */
+  IO_MCP23S17A,
+  IO_MCP23S17B,
+  IO_MPR121,    /* 12 electrode capacitive touch */
 }iodev_e;
 
+int iic_open_bus(const char *devName);
+int iic_is_spi(int bus);
+int iic_set_recovery(int bus, int scl, int sda);
+int iic_set_budget(int bus, int pct, int clock);
+int iic_set_poll(int xio, int rate);
 int init_iic(void);
 //iodev_e dev_type(int devAddr);
-int connect_iic(int devAddr);
+int connect_iic(int bus, int devAddr);
 void poll_iic(int xio);
-int write_iic(int devAddr, int regno, char *buf, int n);
-void test_iic(int devAddr, int regaddr);
+int write_iic(int bus, int devAddr, int regno, char *buf, int n);
+int read_iic(int bus, int devAddr, int regno, char *buf, int n);
+void test_iic(int bus, int devAddr, int regaddr);
 void close_iic(void);
+unsigned iic_errors(int xio);
 
 #endif
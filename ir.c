@@ -0,0 +1,539 @@
+/**** ir.c *********************************/
+/*   Universal RPi GPIO keyboard daemon    */
+/*                                         */
+/* infrared remote receivers               */
+/*******************************************/
+
+/*
+   This file is part of the Universal Raspberry Pi GPIO keyboard daemon.
+
+   This is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   The software is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with the GNU C Library; if not, write to the Free
+   Software Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+   02111-1307 USA.  
+*/
+
+
+/* Decoding for TSOP style IR receivers (output low while a carrier burst,
+ * a "mark", is seen).  The pin is edge captured and every pulse, a mark or
+ * the space between marks, is passed with its length to the NEC, RC5 and
+ * RC6 (mode 0) decoders which all run side by side.  ir_pulse() takes
+ * nothing but the pulse, so recorded traces can be fed straight in.
+ *
+ * Complete frames are queued for the main loop which looks up the key in
+ * the map.  The key is pressed on a new frame and held while repeat frames
+ * (NEC repeat codes, RC5/RC6 frames with the same toggle bit) keep coming,
+ * then released IR_HOLD_US after the last one.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "config.h"
+#include "gpio.h"
+#include "edge.h"
+#include "ir.h"
+#include "uinput.h"
+#include "keystate.h"
+#include "stream.h"
+#include "debug.h"
+
+#define NEC_LEAD_MARK   9000
+#define NEC_LEAD_SPACE  4500
+#define NEC_RPT_SPACE   2250
+#define NEC_BIT         562
+#define NEC_ONE_SPACE   1687
+#define RC5_T           889
+#define RC6_T           444
+#define RC6_LEAD_MARK   2666
+#define RC6_LEAD_SPACE  889
+
+typedef struct{
+  int proto;
+  int addr;
+  int cmd;
+  int toggle;
+  int repeat;
+  unsigned long long t;
+}ir_frame_s;
+
+typedef struct{
+  int state;
+  int n;                        /* bits or half bits collected */
+  unsigned data;
+  unsigned char half[48];       /* Manchester half bits, 1 is a mark */
+}ir_dec_s;
+
+typedef struct{
+  int proto;
+  int addr;
+  int cmd;
+  int key;
+}ir_key_s;
+
+typedef struct{
+  char *name;
+  int pin;
+  unsigned long long t_edge;
+  ir_dec_s nec, rc5, rc6;
+
+  /* edge thread to main loop */
+  ir_frame_s q[IR_FRAMES];
+  volatile unsigned head, tail;
+  volatile unsigned overrun;
+
+  /* main loop only */
+  ir_key_s keys[MAX_IR_KEYS];
+  int nkeys;
+  int held;                     /* key being held or -1 */
+  ir_frame_s last;
+  unsigned overrun_seen;
+}ir_rx_s;
+
+static const char *ir_proto_names[IR_PROTOCOLS] = { "NEC", "RC5", "RC6" };
+
+static ir_rx_s ir_rx[MAX_IR_RX];
+static int ir_count = 0;
+
+static void ir_edge(void *ctx, int pin, int level, unsigned long long t);
+static int ir_near(unsigned d, unsigned ref);
+static int ir_units(unsigned d, unsigned t, int max);
+static int ir_halves(ir_dec_s *s, int mark, int units);
+static int ir_nec(ir_dec_s *s, int mark, unsigned d, ir_frame_s *f);
+static int ir_rc5(ir_dec_s *s, int mark, unsigned d, ir_frame_s *f);
+static int ir_rc6(ir_dec_s *s, int mark, unsigned d, ir_frame_s *f);
+
+
+/* add a receiver on "pin", returns its number or -1 */
+int ir_add(const char *name, int pin) {
+
+  ir_rx_s *ir;
+
+  if (ir_count >= MAX_IR_RX) {
+    return(-1);
+  }
+  ir = &ir_rx[ir_count];
+  memset(ir, 0, sizeof(ir_rx_s));
+  ir->name = strdup(name);
+  ir->pin = pin;
+  ir->held = -1;
+
+  if (edge_add(pin, ir_edge, ir) < 0) {
+    return(-1);
+  }
+
+  return(ir_count++);
+}
+
+
+int ir_find(const char *name) {
+
+  int i;
+
+  for (i=0; i<ir_count; i++) {
+    if (!strcmp(ir_rx[i].name, name)) {
+      return(i);
+    }
+  }
+  return(-1);
+}
+
+
+int ir_find_proto(const char *name) {
+
+  int i;
+
+  for (i=0; i<IR_PROTOCOLS; i++) {
+    if (!strcmp(ir_proto_names[i], name)) {
+      return(i);
+    }
+  }
+  return(-1);
+}
+
+
+/* map a (protocol, address, command) from receiver "ir" to "key" */
+int ir_map(int ir, int proto, int addr, int cmd, int key) {
+
+  ir_key_s *k;
+
+  if ((ir < 0) || (ir >= ir_count) || (ir_rx[ir].nkeys >= MAX_IR_KEYS)) {
+    return(-1);
+  }
+  k = &ir_rx[ir].keys[ir_rx[ir].nkeys++];
+  k->proto = proto;
+  k->addr = addr;
+  k->cmd = cmd;
+  k->key = key;
+
+  return(0);
+}
+
+
+/* called on the edge thread, the receiver output is active low so a rising
+ * edge is the end of a mark
+ */
+static void ir_edge(void *ctx, int pin, int level, unsigned long long t) {
+
+  ir_rx_s *ir = (ir_rx_s *) ctx;
+  unsigned long long d = t - ir->t_edge;
+
+  if (ir->t_edge) {
+    ir_pulse(ir - ir_rx, level, (d > 0xffffffffULL) ? 0xffffffff : (unsigned) d, t);
+  }
+  ir->t_edge = t;
+}
+
+
+/* one pulse of "dur" us ending at "t", a mark or a space */
+void ir_pulse(int n, int mark, unsigned dur, unsigned long long t) {
+
+  ir_rx_s *ir = &ir_rx[n];
+  ir_frame_s f;
+  int got;
+
+  memset(&f, 0, sizeof(f));
+  got = ir_nec(&ir->nec, mark, dur, &f);
+  got |= ir_rc5(&ir->rc5, mark, dur, &f);
+  got |= ir_rc6(&ir->rc6, mark, dur, &f);
+  if (!got) {
+    return;
+  }
+
+  /* whoever finished, the others were following noise */
+  memset(&ir->nec, 0, sizeof(ir_dec_s));
+  memset(&ir->rc5, 0, sizeof(ir_dec_s));
+  memset(&ir->rc6, 0, sizeof(ir_dec_s));
+
+  if (ir->head - ir->tail >= IR_FRAMES) {
+    ir->overrun++;
+    return;
+  }
+  f.t = t;
+  ir->q[ir->head % IR_FRAMES] = f;
+  __sync_synchronize();
+  ir->head++;
+}
+
+
+/* within tolerance of a fixed length, receivers stretch marks ~100us */
+static int ir_near(unsigned d, unsigned ref) {
+
+  unsigned tol = ref / 4 + 100;
+
+  return((d + tol >= ref) && (d <= ref + tol));
+}
+
+
+/* length in whole Manchester half bits of "t" us, 0 if it isn't one */
+static int ir_units(unsigned d, unsigned t, int max) {
+
+  int u = (d + t / 2) / t;
+  unsigned tol = t * 3 / 10 + 40;
+
+  if ((u < 1) || (u > max)) {
+    return(0);
+  }
+  if ((d + tol < u * t) || (d > u * t + tol)) {
+    return(0);
+  }
+  return(u);
+}
+
+
+static int ir_halves(ir_dec_s *s, int mark, int units) {
+
+  if (s->n + units > (int) sizeof(s->half)) {
+    return(-1);
+  }
+  while (units--) {
+    s->half[s->n++] = mark;
+  }
+  return(0);
+}
+
+
+/* NEC: 9ms/4.5ms leader, 32 bits LSB first as pulse distance (562us mark,
+ * 562us or 1687us space), a final mark.  A held button sends 9ms/2.25ms
+ * and a mark about every 108ms.
+ */
+static int ir_nec(ir_dec_s *s, int mark, unsigned d, ir_frame_s *f) {
+
+  unsigned a, na, c, nc;
+
+  switch (s->state) {
+    case 0:
+      if (mark && ir_near(d, NEC_LEAD_MARK)) {
+        s->state = 1;
+      }
+      return(0);
+    case 1:
+      if (!mark && ir_near(d, NEC_LEAD_SPACE)) {
+        s->state = 2;
+        s->n = 0;
+        s->data = 0;
+        return(0);
+      }
+      if (!mark && ir_near(d, NEC_RPT_SPACE)) {
+        s->state = 4;
+        return(0);
+      }
+      break;
+    case 2:
+      if (mark && ir_near(d, NEC_BIT)) {
+        s->state = 3;
+        return(0);
+      }
+      break;
+    case 3:
+      if (!mark && (ir_near(d, NEC_BIT) || ir_near(d, NEC_ONE_SPACE))) {
+        if (d > (NEC_BIT + NEC_ONE_SPACE) / 2) {
+          s->data |= 1u << s->n;
+        }
+        s->n++;
+        s->state = (s->n == 32) ? 5 : 2;
+        return(0);
+      }
+      break;
+    case 4:
+      if (mark && ir_near(d, NEC_BIT)) {
+        s->state = 0;
+        f->proto = IR_NEC;
+        f->repeat = 1;
+        return(1);
+      }
+      break;
+    case 5:
+      if (mark && ir_near(d, NEC_BIT)) {
+        s->state = 0;
+        a = s->data & 0xff;
+        na = (s->data >> 8) & 0xff;
+        c = (s->data >> 16) & 0xff;
+        nc = s->data >> 24;
+        if ((c ^ nc) != 0xff) {
+          return(0);
+        }
+        /* extended NEC drops the inverted address for a 16 bit one */
+        f->proto = IR_NEC;
+        f->addr = ((a ^ na) == 0xff) ? a : (s->data & 0xffff);
+        f->cmd = c;
+        return(1);
+      }
+      break;
+  }
+
+  /* the pulse that broke the frame may be the start of the next one */
+  s->state = (mark && ir_near(d, NEC_LEAD_MARK)) ? 1 : 0;
+
+  return(0);
+}
+
+
+/* RC5: 14 Manchester bits of 1778us, a one is space then mark.  Start bit,
+ * field bit (inverted command bit 6 on RC5X), toggle, 5 bit address, 6 bit
+ * command.  The first half of the start bit is indistinguishable from idle
+ * and a trailing half space is only seen as the end of the frame.
+ */
+static int ir_rc5(ir_dec_s *s, int mark, unsigned d, ir_frame_s *f) {
+
+  int u = ir_units(d, RC5_T, 2);
+  int i, bits = 0;
+
+  if (!u) {
+    s->n = 0;
+    return(0);
+  }
+  if (!s->n) {
+    if (!mark) {
+      return(0);
+    }
+    s->half[s->n++] = 0;
+  }
+  if (ir_halves(s, mark, u) < 0) {
+    s->n = 0;
+    return(0);
+  }
+
+  if ((s->n < 27) || ((s->n == 27) && !mark)) {
+    return(0);
+  }
+  if (s->n == 27) {
+    s->half[s->n++] = 0;
+  }
+  if (s->n > 28) {
+    s->n = 0;
+    return(0);
+  }
+  s->n = 0;
+
+  for (i=0; i<14; i++) {
+    if (s->half[2*i] == s->half[2*i+1]) {
+      return(0);
+    }
+    bits = (bits << 1) | s->half[2*i+1];
+  }
+  if (!(bits & 0x2000)) {
+    return(0);
+  }
+
+  f->proto = IR_RC5;
+  f->toggle = (bits >> 11) & 1;
+  f->addr = (bits >> 6) & 0x1f;
+  f->cmd = (bits & 0x3f) | ((~bits >> 6) & 0x40);
+
+  return(1);
+}
+
+
+/* RC6 mode 0: 2666us/889us leader, then Manchester bits of 889us where a
+ * one is mark then space: start bit (1), 3 mode bits, a double length
+ * trailer bit that is the toggle, 8 bit address and 8 bit command.
+ */
+static int ir_rc6(ir_dec_s *s, int mark, unsigned d, ir_frame_s *f) {
+
+  unsigned char *h = s->half;
+  int u, i, bits = 0;
+
+  switch (s->state) {
+    case 0:
+      if (mark && ir_near(d, RC6_LEAD_MARK)) {
+        s->state = 1;
+      }
+      return(0);
+    case 1:
+      if (!mark && ir_near(d, RC6_LEAD_SPACE)) {
+        s->state = 2;
+        s->n = 0;
+      }
+      else {
+        s->state = 0;
+      }
+      return(0);
+  }
+
+  if (!(u = ir_units(d, RC6_T, 3)) || (ir_halves(s, mark, u) < 0)) {
+    s->state = (mark && ir_near(d, RC6_LEAD_MARK)) ? 1 : 0;
+    return(0);
+  }
+
+  if ((s->n < 43) || ((s->n == 43) && !mark)) {
+    return(0);
+  }
+  if (s->n == 43) {
+    h[s->n++] = 0;
+  }
+  s->state = 0;
+  if (s->n > 44) {
+    return(0);
+  }
+
+  /* start bit one, mode bits all zero */
+  if (!h[0] || h[1]) {
+    return(0);
+  }
+  for (i=1; i<4; i++) {
+    if (h[2*i] || !h[2*i+1]) {
+      return(0);
+    }
+  }
+  if ((h[8] != h[9]) || (h[10] != h[11]) || (h[8] == h[10])) {
+    return(0);
+  }
+  for (i=0; i<16; i++) {
+    if (h[12+2*i] == h[13+2*i]) {
+      return(0);
+    }
+    bits = (bits << 1) | h[12+2*i];
+  }
+
+  f->proto = IR_RC6;
+  f->toggle = h[8];
+  f->addr = bits >> 8;
+  f->cmd = bits & 0xff;
+
+  return(1);
+}
+
+
+/* called from the main loop: turn decoded frames into key presses and
+ * release held keys once their repeat frames stop
+ */
+void ir_poll(void) {
+
+  ir_rx_s *ir;
+  ir_frame_s *f;
+  unsigned long long now;
+  int i, j;
+
+  now = gpio_time_us();
+
+  for (i=0; i<ir_count; i++) {
+    ir = &ir_rx[i];
+
+    while (ir->tail != ir->head) {
+      __sync_synchronize();
+      f = &ir->q[ir->tail % IR_FRAMES];
+
+      if (debug_on()) {
+        if (f->repeat) {
+          printf("%s: %s repeat\n", ir->name, ir_proto_names[f->proto]);
+        }
+        else {
+          printf("%s: %s/0x%02x/0x%02x toggle %d\n", ir->name,
+                 ir_proto_names[f->proto], f->addr, f->cmd, f->toggle);
+        }
+      }
+
+      /* a repeat, or the same frame again while the button is held */
+      if ((ir->held >= 0) && (f->repeat ||
+          ((f->proto == ir->last.proto) && (f->addr == ir->last.addr) &&
+           (f->cmd == ir->last.cmd) && (f->toggle == ir->last.toggle)))) {
+        ir->last.t = f->t;
+      }
+      else if (!f->repeat) {
+        uinput_stamp(f->t);
+        if (ir->held >= 0) {
+          keystate_set(ir->held, 0, f->t);
+          stream_event(STREAM_KEY, STREAM_IR, i, ir->pin, ir->held, 0, 0, f->t);
+          sendKey(ir->held, 0);
+          ir->held = -1;
+        }
+        for (j=0; j<ir->nkeys; j++) {
+          if ((ir->keys[j].proto == f->proto) && (ir->keys[j].addr == f->addr) &&
+              (ir->keys[j].cmd == f->cmd)) {
+            ir->held = ir->keys[j].key;
+            keystate_set(ir->held, 1, f->t);
+            stream_event(STREAM_KEY, STREAM_IR, i, ir->pin, ir->held, 1, 1, f->t);
+            sendKey(ir->held, 1);
+            break;
+          }
+        }
+        ir->last = *f;
+      }
+      ir->tail++;
+    }
+
+    if ((ir->held >= 0) && (now > ir->last.t + IR_HOLD_US)) {
+      uinput_stamp(0);
+      keystate_set(ir->held, 0, now);
+      stream_event(STREAM_KEY, STREAM_IR, i, ir->pin, ir->held, 0, 0, now);
+      sendKey(ir->held, 0);
+      ir->held = -1;
+    }
+
+    if ((ir->overrun != ir->overrun_seen) && debug_on()) {
+      printf("%s: %u frames dropped\n", ir->name, ir->overrun - ir->overrun_seen);
+      ir->overrun_seen = ir->overrun;
+    }
+  }
+}
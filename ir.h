@@ -0,0 +1,49 @@
+/**** ir.h *********************************/
+/*   Universal RPi GPIO keyboard daemon    */
+/*                                         */
+/* infrared remote receivers               */
+/*******************************************/
+
+/*
+   This file is part of the Universal Raspberry Pi GPIO keyboard daemon.
+
+   This is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   The software is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with the GNU C Library; if not, write to the Free
+   Software Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+   02111-1307 USA.  
+*/
+
+
+#ifndef _IR_H_
+#define _IR_H_
+
+#define MAX_IR_RX       4
+#define MAX_IR_KEYS     64
+#define IR_FRAMES       16      /* decoded frames waiting for the main loop */
+#define IR_HOLD_US      150000  /* key released this long after the last frame */
+
+typedef enum {
+  IR_NEC = 0,
+  IR_RC5,
+  IR_RC6,
+  IR_PROTOCOLS
+} ir_proto_e;
+
+int ir_add(const char *name, int pin);
+int ir_find(const char *name);
+int ir_find_proto(const char *name);
+int ir_map(int ir, int proto, int addr, int cmd, int key);
+void ir_pulse(int ir, int mark, unsigned dur, unsigned long long t);
+void ir_poll(void);
+
+#endif
@@ -0,0 +1,116 @@
+/**** keystate.c ***************************/
+/*   Universal RPi GPIO keyboard daemon    */
+/*                                         */
+/* shared key state table                  */
+/*******************************************/
+
+/*
+   This file is part of the Universal Raspberry Pi GPIO keyboard daemon.
+
+   This is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   The software is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with the GNU C Library; if not, write to the Free
+   Software Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+   02111-1307 USA.  
+*/
+
+
+
+/* The live key state table in shared memory.  Inputs mark key codes up
+ * and down as they change after debouncing; the first change in a main
+ * loop pass opens the seqlock and keystate_publish() closes it at the
+ * end of the pass, so readers see whole passes and the scan only pays
+ * for the words that changed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include "keystate.h"
+#include "debug.h"
+
+static keystate_s *ks = NULL;
+static int ks_open = 0;                 /* seqlock held for this pass */
+
+
+int keystate_open(const char *path) {
+
+  int fd;
+
+  fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    return(-1);
+  }
+  if (ftruncate(fd, sizeof(keystate_s)) < 0) {
+    close(fd);
+    return(-1);
+  }
+  ks = (keystate_s *) mmap(NULL, sizeof(keystate_s), PROT_READ | PROT_WRITE,
+                           MAP_SHARED, fd, 0);
+  close(fd);
+  if (ks == MAP_FAILED) {
+    ks = NULL;
+    return(-1);
+  }
+
+  ks->keys = KEY_CNT;
+  ks->version = KEYSTATE_VERSION;
+  __sync_synchronize();
+  ks->magic = KEYSTATE_MAGIC;
+
+  if (debug_on()) {
+    printf("Key state table in %s (%u bytes)\n", path, (unsigned) sizeof(keystate_s));
+  }
+  return(0);
+}
+
+
+/* a key code went down (1) or up (0) at time "t", from the main loop */
+void keystate_set(int code, int down, unsigned long long t) {
+
+  unsigned bit, *w;
+
+  if (!ks || (code <= 0) || (code >= KEY_CNT)) {
+    return;
+  }
+  w = &ks->down[code / 32];
+  bit = 1U << (code % 32);
+  if (!(*w & bit) == !down) {
+    return;
+  }
+
+  if (!ks_open) {
+    ks->seq++;
+    __sync_synchronize();
+    ks_open = 1;
+  }
+  *w ^= bit;
+  if (down) {
+    ks->presses[code]++;
+  }
+  ks->t_change[code] = t;
+  ks->t_update = t;
+}
+
+
+/* end of a main loop pass, let readers see this pass's changes */
+void keystate_publish(void) {
+
+  if (ks_open) {
+    __sync_synchronize();
+    ks->seq++;
+    ks_open = 0;
+  }
+}
@@ -0,0 +1,72 @@
+/**** keystate.h ***************************/
+/*   Universal RPi GPIO keyboard daemon    */
+/*                                         */
+/* shared key state table                  */
+/*******************************************/
+
+/*
+   This file is part of the Universal Raspberry Pi GPIO keyboard daemon.
+
+   This is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   The software is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with the GNU C Library; if not, write to the Free
+   Software Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+   02111-1307 USA.  
+*/
+
+
+
+#ifndef _KEYSTATE_H_
+#define _KEYSTATE_H_
+
+#include <linux/input.h>
+
+#define KEYSTATE_PATH    "/dev/shm/pikeyd"
+#define KEYSTATE_MAGIC   0x646b6970     /* "pikd" */
+#define KEYSTATE_VERSION 1
+
+/* Debounced state of every key code pikeyd can send, for local readers
+ * that map the file read only.  Times are CLOCK_MONOTONIC microseconds.
+ *
+ * The table is guarded by a seqlock: "seq" is odd while pikeyd updates
+ * it.  A reader copies what it needs between two reads of "seq" and
+ * tries again if they differ or are odd, see keystate_snapshot().
+ */
+typedef struct{
+  unsigned magic;
+  unsigned version;
+  volatile unsigned seq;
+  unsigned keys;                                /* KEY_CNT */
+  unsigned long long t_update;                  /* last change of anything */
+  unsigned down[KEY_CNT / 32];                  /* bit per key code */
+  unsigned presses[KEY_CNT];
+  unsigned long long t_change[KEY_CNT];
+}keystate_s;
+
+/* a consistent copy of the table, no system calls */
+static inline void keystate_snapshot(const keystate_s *ks, keystate_s *copy)
+{
+  unsigned seq;
+
+  do {
+    while ((seq = ks->seq) & 1);
+    __sync_synchronize();
+    *copy = *(const keystate_s *) ks;
+    __sync_synchronize();
+  } while (ks->seq != seq);
+}
+
+int keystate_open(const char *path);
+void keystate_set(int code, int down, unsigned long long t);
+void keystate_publish(void);
+
+#endif
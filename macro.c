@@ -0,0 +1,217 @@
+/**** macro.c ******************************/
+/*   Universal RPi GPIO keyboard daemon    */
+/*                                         */
+/* timed key macros                        */
+/*******************************************/
+
+/*
+   This file is part of the Universal Raspberry Pi GPIO keyboard daemon.
+
+   This is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   The software is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with the GNU C Library; if not, write to the Free
+   Software Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+   02111-1307 USA.  
+*/
+
+
+
+/* Key sequences played one step at a time from the main loop, so the
+ * scan carries on while a long macro (or several) plays.  A macro is
+ * compiled from its configuration into press, release and delay steps;
+ * a delay only holds up its own macro, resuming on the first main loop
+ * pass after it runs out (the loop runs every 4ms or so).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <linux/input.h>
+#include "config.h"
+#include "gpio.h"
+#include "macro.h"
+#include "uinput.h"
+#include "debug.h"
+
+#define STEP_PRESS      0
+#define STEP_RELEASE    1
+#define STEP_DELAY      2
+
+typedef struct{
+  unsigned char op;
+  unsigned short arg;           /* key code or ms */
+}macro_step_s;
+
+typedef struct{
+  char *name;
+  macro_step_s step[MACRO_STEPS];
+  int steps;
+  int pc;                       /* next step, -1 when not playing */
+  unsigned long long t_resume;  /* end of the running delay, 0 for none */
+}macro_s;
+
+extern key_names_s key_names[];
+int find_key(const char *name);
+
+static macro_s macro[MAX_MACROS];
+static int macro_count = 0;
+
+
+int macro_add(const char *name) {
+
+  macro_s *m;
+
+  if (macro_count >= MAX_MACROS) {
+    return(-1);
+  }
+  m = &macro[macro_count];
+  memset(m, 0, sizeof(macro_s));
+  m->name = strdup(name);
+  m->pc = -1;
+
+  return(macro_count++);
+}
+
+
+int macro_find(const char *name) {
+
+  int i;
+
+  for (i=0; i<macro_count; i++) {
+    if (!strcmp(name, macro[i].name)) {
+      return(i);
+    }
+  }
+  return(-1);
+}
+
+
+static int add_step(macro_s *m, int op, int arg) {
+
+  if (m->steps >= MACRO_STEPS) {
+    return(-1);
+  }
+  m->step[m->steps].op = op;
+  m->step[m->steps].arg = arg;
+  m->steps++;
+
+  return(0);
+}
+
+
+/* Compile one configuration word into steps:
+ *   KEY_x       press and release
+ *   +KEY_x      press
+ *   -KEY_x      release
+ *   KEY_x/ms    press, hold for "ms" and release
+ *   DELAY       wait "arg" ms
+ * Returns the number of words used, 0 on error.
+ */
+int macro_step(int n, const char *step, const char *arg) {
+
+  macro_s *m = &macro[n];
+  char key_str[32];
+  char *end_ptr;
+  int k, ms = -1;
+
+  if (!strcmp(step, "DELAY")) {
+    if (!arg || ((ms = (int) strtol(arg, &end_ptr, 10)) < 0) || *end_ptr ||
+        (ms > 0xffff) || (add_step(m, STEP_DELAY, ms) < 0)) {
+      return(0);
+    }
+    return(2);
+  }
+
+  if ((*step == '+') || (*step == '-')) {
+    if (((k = find_key(step + 1)) == 0) ||
+        (add_step(m, (*step == '+') ? STEP_PRESS : STEP_RELEASE, key_names[k].code) < 0)) {
+      return(0);
+    }
+  }
+  else {
+    if (sscanf(step, "%31[^/]/%d", key_str, &ms) < 1) {
+      return(0);
+    }
+    if (((k = find_key(key_str)) == 0) || (strchr(step, '/') && (ms < 0)) ||
+        (ms > 0xffff) || (add_step(m, STEP_PRESS, key_names[k].code) < 0) ||
+        ((ms >= 0) && (add_step(m, STEP_DELAY, ms) < 0)) ||
+        (add_step(m, STEP_RELEASE, key_names[k].code) < 0)) {
+      return(0);
+    }
+  }
+  uinput_use_key(key_names[k].code);
+
+  return(1);
+}
+
+
+int macro_is_key(int key) {
+
+  return((key >= MACRO_KEY) && (key < MACRO_KEY + macro_count));
+}
+
+
+/* start the macro a key code stands for, a macro already playing
+ * carries on instead of starting over */
+int macro_play(int key) {
+
+  macro_s *m;
+
+  if (!macro_is_key(key)) {
+    return(-1);
+  }
+  m = &macro[key - MACRO_KEY];
+  if (m->pc < 0) {
+    m->pc = 0;
+    m->t_resume = 0;
+    if (debug_lvl() >= DEBUG_DEV2) {
+      printf("%s: playing %d steps\n", m->name, m->steps);
+    }
+  }
+
+  return(0);
+}
+
+
+/* run every playing macro up to its next delay, called from the main loop */
+void macro_poll(void) {
+
+  macro_s *m;
+  macro_step_s *s;
+  unsigned long long now;
+  int i;
+
+  now = gpio_time_us();
+  uinput_stamp(0);
+  for (i=0; i<macro_count; i++) {
+    m = &macro[i];
+    while ((m->pc >= 0) && (m->pc < m->steps)) {
+      s = &m->step[m->pc];
+      if (s->op == STEP_DELAY) {
+        if (!m->t_resume) {
+          m->t_resume = now + s->arg * 1000ULL;
+        }
+        if (now < m->t_resume) {
+          break;
+        }
+        m->t_resume = 0;
+      }
+      else {
+        sendKey(s->arg, s->op == STEP_PRESS);
+      }
+      m->pc++;
+    }
+    if (m->pc >= m->steps) {
+      m->pc = -1;
+    }
+  }
+}
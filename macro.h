@@ -0,0 +1,42 @@
+/**** macro.h ******************************/
+/*   Universal RPi GPIO keyboard daemon    */
+/*                                         */
+/* timed key macros                        */
+/*******************************************/
+
+/*
+   This file is part of the Universal Raspberry Pi GPIO keyboard daemon.
+
+   This is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   The software is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with the GNU C Library; if not, write to the Free
+   Software Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+   02111-1307 USA.  
+*/
+
+
+
+#ifndef _MACRO_H_
+#define _MACRO_H_
+
+#define MAX_MACROS      32
+#define MACRO_STEPS     64
+#define MACRO_KEY       0x300   /* key codes from here up play a macro */
+
+int macro_add(const char *name);
+int macro_find(const char *name);
+int macro_step(int m, const char *step, const char *arg);
+int macro_play(int key);
+int macro_is_key(int key);
+void macro_poll(void);
+
+#endif
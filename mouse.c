@@ -0,0 +1,237 @@
+/**** mouse.c ******************************/
+/*   Universal RPi GPIO keyboard daemon    */
+/*                                         */
+/* GPIO pointer device                     */
+/*******************************************/
+
+/*
+   This file is part of the Universal Raspberry Pi GPIO keyboard daemon.
+
+   This is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   The software is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with the GNU C Library; if not, write to the Free
+   Software Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+   02111-1307 USA.  
+*/
+
+
+/* Direction switches (an arcade stick or four buttons) driving the pointer.
+ * Motion runs on its own thread and timer at MOUSE_RATE, independent of the
+ * key scan, reading the pins straight from the level register.  Speed ramps
+ * from MOUSE_START to MOUSE_MAX pixels/s over the acceleration time and is
+ * accumulated in 1/256 pixel steps so slow speeds still move evenly.  Each
+ * tick with anything to report becomes one frame: dx, dy and button changes
+ * under a single SYN_REPORT, stamped with the time the pins were read and
+ * handed straight to the uinput writer with uinput_post().
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <linux/input.h>
+#include "config.h"
+#include "gpio.h"
+#include "mouse.h"
+#include "uinput.h"
+#include "debug.h"
+
+static const char *mouse_names[MOUSE_INPUTS] = {
+  "MOUSE_UP", "MOUSE_DOWN", "MOUSE_LEFT", "MOUSE_RIGHT",
+  "MOUSE_BTN_LEFT", "MOUSE_BTN_RIGHT", "MOUSE_BTN_MIDDLE"
+};
+static const int mouse_btn[3] = { BTN_LEFT, BTN_RIGHT, BTN_MIDDLE };
+
+static int mouse_pin[MOUSE_INPUTS] = { -1, -1, -1, -1, -1, -1, -1 };
+static int mouse_used = 0;
+static int mouse_rate = MOUSE_RATE;
+static int mouse_v0 = MOUSE_START;
+static int mouse_v1 = MOUSE_MAX;
+static int mouse_ramp = MOUSE_ACCEL_MS;
+static pthread_t mouse_thread;
+
+static void *mouse_run(void *arg);
+
+
+int mouse_find_input(const char *name) {
+
+  int i;
+
+  for (i=0; i<MOUSE_INPUTS; i++) {
+    if (!strcmp(mouse_names[i], name)) {
+      return(i);
+    }
+  }
+  return(-1);
+}
+
+
+/* "input" is read from "pin", which is set up as an input outside the scan */
+int mouse_set_pin(int input, int pin) {
+
+  if ((input < 0) || (input >= MOUSE_INPUTS) || (mouse_pin[input] >= 0)) {
+    return(-1);
+  }
+  if (gpio_pincfg(pin, GPIO_IN, NULL) <= 0) {
+    return(-1);
+  }
+  mouse_pin[input] = pin;
+
+  if (!mouse_used) {
+    uinput_use_rel(REL_X);
+    uinput_use_rel(REL_Y);
+  }
+  if (input >= MOUSE_BTN_LEFT) {
+    uinput_use_key(mouse_btn[input - MOUSE_BTN_LEFT]);
+  }
+  mouse_used |= 1 << input;
+
+  return(0);
+}
+
+
+/* pixels/s at first, pixels/s at full speed, ms to get there */
+void mouse_set_speed(int start, int max, int accel_ms) {
+
+  mouse_v0 = start;
+  mouse_v1 = (max > start) ? max : start;
+  mouse_ramp = accel_ms;
+}
+
+
+void mouse_set_rate(int rate) {
+
+  mouse_rate = rate;
+}
+
+
+int mouse_start(void) {
+
+  if (!mouse_used) {
+    return(0);
+  }
+  if (pthread_create(&mouse_thread, NULL, mouse_run, NULL)) {
+    perror("mouse thread");
+    return(-1);
+  }
+  if (debug_on()) {
+    printf("Mouse at %d Hz, %d to %d pixels/s over %dms\n", mouse_rate,
+           mouse_v0, mouse_v1, mouse_ramp);
+  }
+  return(1);
+}
+
+
+/* speed in 1/256 pixel per tick after "ticks" of holding a direction */
+static int mouse_step(int ticks) {
+
+  long long v = mouse_v1;
+  long long t_ms = (long long) ticks * 1000 / mouse_rate;
+
+  if (t_ms < mouse_ramp) {
+    v = mouse_v0 + (mouse_v1 - mouse_v0) * t_ms / mouse_ramp;
+  }
+  return((int) (v * 256 / mouse_rate));
+}
+
+
+static void *mouse_run(void *arg) {
+
+  struct input_event ev[8];
+  struct timespec next;
+  unsigned long long t;
+  long period = 1000000000L / mouse_rate;
+  int acc[2] = { 0, 0 };         /* sub pixel remainders, x and y */
+  int held = 0;                  /* ticks any direction has been held */
+  int btn = 0, btn_raw = 0, btn_cnt = 0;
+  int pins, lvl, dir[2], step, d[2];
+  int i, n;
+
+  clock_gettime(CLOCK_MONOTONIC, &next);
+
+  while (1) {
+    next.tv_nsec += period;
+    while (next.tv_nsec >= 1000000000L) {
+      next.tv_nsec -= 1000000000L;
+      next.tv_sec++;
+    }
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+
+    /* switches pull their pins low */
+    pins = ~gpio_levels();
+    t = gpio_time_us();
+    dir[0] = dir[1] = 0;
+    if ((mouse_pin[MOUSE_LEFT] >= 0) && (pins & (1 << mouse_pin[MOUSE_LEFT]))) {
+      dir[0]--;
+    }
+    if ((mouse_pin[MOUSE_RIGHT] >= 0) && (pins & (1 << mouse_pin[MOUSE_RIGHT]))) {
+      dir[0]++;
+    }
+    if ((mouse_pin[MOUSE_UP] >= 0) && (pins & (1 << mouse_pin[MOUSE_UP]))) {
+      dir[1]--;
+    }
+    if ((mouse_pin[MOUSE_DOWN] >= 0) && (pins & (1 << mouse_pin[MOUSE_DOWN]))) {
+      dir[1]++;
+    }
+
+    n = 0;
+    if (dir[0] || dir[1]) {
+      step = mouse_step(held++);
+      for (i=0; i<2; i++) {
+        acc[i] += dir[i] * step;
+        d[i] = acc[i] / 256;
+        acc[i] -= d[i] * 256;
+        if (d[i]) {
+          ev[n].type = EV_REL;
+          ev[n].code = i ? REL_Y : REL_X;
+          ev[n].value = d[i];
+          n++;
+        }
+      }
+    }
+    else {
+      held = 0;
+      acc[0] = acc[1] = 0;
+    }
+
+    /* buttons change once they have been steady for MOUSE_BOUNCE ticks */
+    lvl = 0;
+    for (i=0; i<3; i++) {
+      if ((mouse_pin[MOUSE_BTN_LEFT + i] >= 0) &&
+          (pins & (1 << mouse_pin[MOUSE_BTN_LEFT + i]))) {
+        lvl |= 1 << i;
+      }
+    }
+    if (lvl != btn_raw) {
+      btn_raw = lvl;
+      btn_cnt = 0;
+    }
+    else if ((btn_raw != btn) && (++btn_cnt >= MOUSE_BOUNCE)) {
+      for (i=0; i<3; i++) {
+        if ((btn ^ btn_raw) & (1 << i)) {
+          ev[n].type = EV_KEY;
+          ev[n].code = mouse_btn[i];
+          ev[n].value = (btn_raw >> i) & 1;
+          n++;
+        }
+      }
+      btn = btn_raw;
+    }
+
+    if (n) {
+      uinput_post(ev, n, t);
+    }
+  }
+
+  return(NULL);
+}
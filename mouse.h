@@ -0,0 +1,53 @@
+/**** mouse.h ******************************/
+/*   Universal RPi GPIO keyboard daemon    */
+/*                                         */
+/* GPIO pointer device                     */
+/*******************************************/
+
+/*
+   This file is part of the Universal Raspberry Pi GPIO keyboard daemon.
+
+   This is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   The software is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with the GNU C Library; if not, write to the Free
+   Software Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+   02111-1307 USA.  
+*/
+
+
+#ifndef _MOUSE_H_
+#define _MOUSE_H_
+
+#define MOUSE_RATE      1000    /* motion ticks per second */
+#define MOUSE_START     200     /* pixels/s when a direction is pressed */
+#define MOUSE_MAX       1500    /* pixels/s once fully accelerated */
+#define MOUSE_ACCEL_MS  600     /* time from start to max speed */
+#define MOUSE_BOUNCE    5       /* ticks a button must be steady */
+
+typedef enum{
+  MOUSE_UP = 0,
+  MOUSE_DOWN,
+  MOUSE_LEFT,
+  MOUSE_RIGHT,
+  MOUSE_BTN_LEFT,
+  MOUSE_BTN_RIGHT,
+  MOUSE_BTN_MIDDLE,
+  MOUSE_INPUTS
+}mouse_in_e;
+
+int mouse_find_input(const char *name);
+int mouse_set_pin(int input, int pin);
+void mouse_set_speed(int start, int max, int accel_ms);
+void mouse_set_rate(int rate);
+int mouse_start(void);
+
+#endif
@@ -26,9 +26,23 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 #include <syslog.h>
+#include "config.h"
+#include "daemon.h"
 #include "gpio.h"
+#include "uinput.h"
+#include "macro.h"
+#include "keystate.h"
 #include "iic.h"
+#include "edge.h"
+#include "encoder.h"
+#include "ir.h"
+#include "ps2.h"
+#include "adc.h"
+#include "counter.h"
+#include "mouse.h"
 #include "debug.h"
 
 void showHelp(void);
@@ -38,6 +52,7 @@ int main(int argc, char *argv[])
 {
   int en_daemonize = 0;
   int i;
+  unsigned long long t_start = gpio_time_us();
 
   for(i=1; i<argc; i++){
     if (!strcmp(argv[i], "-d")) {
@@ -88,31 +103,9 @@ int main(int argc, char *argv[])
     daemonize("/tmp", "/tmp/pikeyd.pid");
   }
 
-<<<<<<< HEAD
-  switch (init_config()) {
-    case 0:
-      return(-1);
-    case 1:
-      break;
-    case 2:
-      init_iic();
-  }
-
-
-  //test_config(); exit(0);
-
-  //test_iic(0x20);  close_iic();  exit(0);
-
-  //printf("init uinput\n");
-=======
   if (!gpio_init()) {
     return(-1);
   }
->>>>>>> key_matrix
-
-  if (!init_uinput()) {
-    return(-1);
-  }
 
   /* config will setup GPIO, which needs to already be initialised */
   switch (init_config()) {
@@ -124,6 +117,16 @@ int main(int argc, char *argv[])
       init_iic();
   }
 
+  /* after the config so the device advertises what was configured */
+  if (!init_uinput()) {
+    return(-1);
+  }
+  edge_start();
+  adc_start();
+  mouse_start();
+
+  printf("Input ready after %lluus\n", gpio_time_us() - t_start);
+
   if (!en_daemonize) {
     printf("Press ^C to exit.\n");
   }
@@ -135,7 +138,19 @@ int main(int argc, char *argv[])
     for (i=0; i<=mat_count(); i++) {
       gpio_poll(i);
     }
-    usleep(4000);
+    for (i=0; i<xio_num(); i++) {
+      xio_poll(i);
+    }
+    edge_dispatch();
+    encoder_report();
+    ir_poll();
+    ps2_report();
+    adc_poll();
+    counter_poll();
+    macro_poll();
+    keystate_publish();
+    uinput_flush();
+    uinput_sleep(4000);
   }
 
   return 0;
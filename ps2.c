@@ -0,0 +1,289 @@
+/**** ps2.c ********************************/
+/*   Universal RPi GPIO keyboard daemon    */
+/*                                         */
+/* PS/2 keyboard receiver                  */
+/*******************************************/
+
+/*
+   This file is part of the Universal Raspberry Pi GPIO keyboard daemon.
+
+   This is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   The software is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with the GNU C Library; if not, write to the Free
+   Software Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+   02111-1307 USA.  
+*/
+
+
+/* A PS/2 keyboard or keypad on two GPIO pins.  The device drives the clock
+ * at 10-16kHz and data is valid on every falling clock edge, so both pins
+ * are edge captured and the data level is taken at each clock fall.
+ * Frames are 11 bits: start (0), 8 data bits LSB first, odd parity and
+ * stop (1).  Bytes are scan code set 2, decoded here into key presses and
+ * releases queued for the main loop.  The keyboard's own typematic repeat
+ * is dropped, held keys repeat through uinput like any other.
+ *
+ * ps2_clock() is the whole receiver for one clock edge, a captured stream
+ * can be replayed through it.  Bad frames are counted and shown with -D.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <linux/input.h>
+#include "config.h"
+#include "gpio.h"
+#include "edge.h"
+#include "ps2.h"
+#include "uinput.h"
+#include "debug.h"
+
+typedef struct{
+  char *name;
+  int clk, data;
+  int nbit;
+  unsigned frame;
+  unsigned long long t_clk;
+  int ext, brk, skip;
+  unsigned char down[KEY_CNT / 8];
+  volatile unsigned frames, errors, unknown;
+  volatile int last_unknown;
+  unsigned err_seen, unk_seen;
+}ps2_s;
+
+/* scan code set 2 */
+static const unsigned short ps2_set2[0x84] = {
+  [0x01] = KEY_F9,          [0x03] = KEY_F5,          [0x04] = KEY_F3,
+  [0x05] = KEY_F1,          [0x06] = KEY_F2,          [0x07] = KEY_F12,
+  [0x09] = KEY_F10,         [0x0a] = KEY_F8,          [0x0b] = KEY_F6,
+  [0x0c] = KEY_F4,          [0x0d] = KEY_TAB,         [0x0e] = KEY_GRAVE,
+  [0x11] = KEY_LEFTALT,     [0x12] = KEY_LEFTSHIFT,   [0x14] = KEY_LEFTCTRL,
+  [0x15] = KEY_Q,           [0x16] = KEY_1,           [0x1a] = KEY_Z,
+  [0x1b] = KEY_S,           [0x1c] = KEY_A,           [0x1d] = KEY_W,
+  [0x1e] = KEY_2,           [0x21] = KEY_C,           [0x22] = KEY_X,
+  [0x23] = KEY_D,           [0x24] = KEY_E,           [0x25] = KEY_4,
+  [0x26] = KEY_3,           [0x29] = KEY_SPACE,       [0x2a] = KEY_V,
+  [0x2b] = KEY_F,           [0x2c] = KEY_T,           [0x2d] = KEY_R,
+  [0x2e] = KEY_5,           [0x31] = KEY_N,           [0x32] = KEY_B,
+  [0x33] = KEY_H,           [0x34] = KEY_G,           [0x35] = KEY_Y,
+  [0x36] = KEY_6,           [0x3a] = KEY_M,           [0x3b] = KEY_J,
+  [0x3c] = KEY_U,           [0x3d] = KEY_7,           [0x3e] = KEY_8,
+  [0x41] = KEY_COMMA,       [0x42] = KEY_K,           [0x43] = KEY_I,
+  [0x44] = KEY_O,           [0x45] = KEY_0,           [0x46] = KEY_9,
+  [0x49] = KEY_DOT,         [0x4a] = KEY_SLASH,       [0x4b] = KEY_L,
+  [0x4c] = KEY_SEMICOLON,   [0x4d] = KEY_P,           [0x4e] = KEY_MINUS,
+  [0x52] = KEY_APOSTROPHE,  [0x54] = KEY_LEFTBRACE,   [0x55] = KEY_EQUAL,
+  [0x58] = KEY_CAPSLOCK,    [0x59] = KEY_RIGHTSHIFT,  [0x5a] = KEY_ENTER,
+  [0x5b] = KEY_RIGHTBRACE,  [0x5d] = KEY_BACKSLASH,   [0x61] = KEY_102ND,
+  [0x66] = KEY_BACKSPACE,   [0x69] = KEY_KP1,         [0x6b] = KEY_KP4,
+  [0x6c] = KEY_KP7,         [0x70] = KEY_KP0,         [0x71] = KEY_KPDOT,
+  [0x72] = KEY_KP2,         [0x73] = KEY_KP5,         [0x74] = KEY_KP6,
+  [0x75] = KEY_KP8,         [0x76] = KEY_ESC,         [0x77] = KEY_NUMLOCK,
+  [0x78] = KEY_F11,         [0x79] = KEY_KPPLUS,      [0x7a] = KEY_KP3,
+  [0x7b] = KEY_KPMINUS,     [0x7c] = KEY_KPASTERISK,  [0x7d] = KEY_KP9,
+  [0x7e] = KEY_SCROLLLOCK,  [0x83] = KEY_F7
+};
+
+/* codes following an E0 prefix */
+static const unsigned short ps2_set2_e0[0x80] = {
+  [0x11] = KEY_RIGHTALT,    [0x14] = KEY_RIGHTCTRL,   [0x15] = KEY_PREVIOUSSONG,
+  [0x1f] = KEY_LEFTMETA,    [0x21] = KEY_VOLUMEDOWN,  [0x23] = KEY_MUTE,
+  [0x27] = KEY_RIGHTMETA,   [0x2f] = KEY_COMPOSE,     [0x32] = KEY_VOLUMEUP,
+  [0x34] = KEY_PLAYPAUSE,   [0x37] = KEY_POWER,       [0x3b] = KEY_STOPCD,
+  [0x3f] = KEY_SLEEP,       [0x4a] = KEY_KPSLASH,     [0x4d] = KEY_NEXTSONG,
+  [0x5a] = KEY_KPENTER,     [0x5e] = KEY_WAKEUP,      [0x69] = KEY_END,
+  [0x6b] = KEY_LEFT,        [0x6c] = KEY_HOME,        [0x70] = KEY_INSERT,
+  [0x71] = KEY_DELETE,      [0x72] = KEY_DOWN,        [0x74] = KEY_RIGHT,
+  [0x75] = KEY_UP,          [0x7a] = KEY_PAGEDOWN,    [0x7c] = KEY_SYSRQ,
+  [0x7d] = KEY_PAGEUP
+};
+
+static ps2_s ps2[MAX_PS2];
+static int ps2_count = 0;
+
+static void ps2_edge(void *ctx, int pin, int level, unsigned long long t);
+static void ps2_byte(ps2_s *p, int code, unsigned long long t);
+static void ps2_key(ps2_s *p, int key, int value, unsigned long long t);
+
+
+/* add a receiver with clock on "clk" and data on "data" */
+int ps2_add(const char *name, int clk, int data) {
+
+  ps2_s *p;
+  int i;
+
+  if (ps2_count >= MAX_PS2) {
+    return(-1);
+  }
+  p = &ps2[ps2_count];
+  memset(p, 0, sizeof(ps2_s));
+  p->name = strdup(name);
+  p->clk = clk;
+  p->data = data;
+
+  if ((edge_add(clk, ps2_edge, p) < 0) || (edge_add(data, NULL, NULL) < 0)) {
+    return(-1);
+  }
+
+  /* any key of the keyboard may turn up */
+  for (i=0; i<(int) (sizeof(ps2_set2) / sizeof(ps2_set2[0])); i++) {
+    uinput_use_key(ps2_set2[i]);
+  }
+  for (i=0; i<(int) (sizeof(ps2_set2_e0) / sizeof(ps2_set2_e0[0])); i++) {
+    uinput_use_key(ps2_set2_e0[i]);
+  }
+  uinput_use_key(KEY_PAUSE);
+
+  return(ps2_count++);
+}
+
+
+/* called on the edge thread */
+static void ps2_edge(void *ctx, int pin, int level, unsigned long long t) {
+
+  ps2_s *p = (ps2_s *) ctx;
+
+  if (!level) {
+    ps2_clock(p - ps2, edge_level(p->data), t);
+  }
+}
+
+
+/* one falling clock edge with the data line at "data" */
+void ps2_clock(int n, int data, unsigned long long t) {
+
+  ps2_s *p = &ps2[n];
+  unsigned f;
+  int i, ones = 0;
+
+  /* a long gap means we came in part way through a frame, start again */
+  if (p->nbit && (t - p->t_clk > PS2_FRAME_US)) {
+    p->errors++;
+    p->nbit = 0;
+  }
+  p->t_clk = t;
+
+  p->frame = (p->nbit ? p->frame : 0) | ((data & 1) << p->nbit);
+  if (++p->nbit < 11) {
+    return;
+  }
+  p->nbit = 0;
+  f = p->frame;
+
+  for (i=1; i<10; i++) {
+    ones += (f >> i) & 1;
+  }
+  if ((f & 1) || !(f & 0x400) || !(ones & 1)) {
+    p->errors++;
+    return;
+  }
+  p->frames++;
+
+  ps2_byte(p, (f >> 1) & 0xff, t);
+}
+
+
+static void ps2_byte(ps2_s *p, int code, unsigned long long t) {
+
+  int key = 0;
+
+  /* the rest of the Pause sequence */
+  if (p->skip) {
+    p->skip--;
+    return;
+  }
+
+  switch (code) {
+    case 0xe0:
+      p->ext = 1;
+      return;
+    case 0xf0:
+      p->brk = 1;
+      return;
+    case 0xe1:
+      /* Pause has no break code, it is E1 14 77 E1 F0 14 F0 77 */
+      p->skip = 7;
+      ps2_key(p, KEY_PAUSE, 1, t);
+      ps2_key(p, KEY_PAUSE, 0, t);
+      return;
+    case 0x00:
+    case 0xaa:
+    case 0xee:
+    case 0xfa:
+    case 0xfc:
+    case 0xfe:
+    case 0xff:
+      /* self test, echo, ack, resend and overrun replies */
+      p->ext = p->brk = 0;
+      return;
+  }
+
+  if (p->ext) {
+    /* the fake shifts wrapped around Print Screen and friends */
+    if ((code == 0x12) || (code == 0x59)) {
+      p->ext = p->brk = 0;
+      return;
+    }
+    if (code < (int) (sizeof(ps2_set2_e0) / sizeof(ps2_set2_e0[0]))) {
+      key = ps2_set2_e0[code];
+    }
+  }
+  else if (code < (int) (sizeof(ps2_set2) / sizeof(ps2_set2[0]))) {
+    key = ps2_set2[code];
+  }
+
+  if (!key) {
+    p->unknown++;
+    p->last_unknown = (p->ext << 8) | code;
+  }
+  else {
+    ps2_key(p, key, !p->brk, t);
+  }
+  p->ext = p->brk = 0;
+}
+
+
+/* queue a key change, the keyboard's own repeats are dropped */
+static void ps2_key(ps2_s *p, int key, int value, unsigned long long t) {
+
+  int down = (p->down[key / 8] >> (key % 8)) & 1;
+
+  if (value == down) {
+    return;
+  }
+  p->down[key / 8] ^= 1 << (key % 8);
+  edge_post(EV_KEY, key, value, t);
+}
+
+
+/* called from the main loop, frame errors and unknown codes with -D */
+void ps2_report(void) {
+
+  unsigned v;
+  int i;
+
+  if (!debug_on()) {
+    return;
+  }
+
+  for (i=0; i<ps2_count; i++) {
+    if ((v = ps2[i].errors) != ps2[i].err_seen) {
+      printf("%s: %u frame errors in %u frames\n", ps2[i].name, v, ps2[i].frames + v);
+      ps2[i].err_seen = v;
+    }
+    if ((v = ps2[i].unknown) != ps2[i].unk_seen) {
+      printf("%s: unknown scan code %s%02x\n", ps2[i].name,
+             (ps2[i].last_unknown & 0x100) ? "E0 " : "", ps2[i].last_unknown & 0xff);
+      ps2[i].unk_seen = v;
+    }
+  }
+}
@@ -0,0 +1,37 @@
+/**** ps2.h ********************************/
+/*   Universal RPi GPIO keyboard daemon    */
+/*                                         */
+/* PS/2 keyboard receiver                  */
+/*******************************************/
+
+/*
+   This file is part of the Universal Raspberry Pi GPIO keyboard daemon.
+
+   This is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   The software is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with the GNU C Library; if not, write to the Free
+   Software Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+   02111-1307 USA.  
+*/
+
+
+#ifndef _PS2_H_
+#define _PS2_H_
+
+#define MAX_PS2         2
+#define PS2_FRAME_US    2000    /* longest gap between clocks of one frame */
+
+int ps2_add(const char *name, int clk, int data);
+void ps2_clock(int n, int data, unsigned long long t);
+void ps2_report(void);
+
+#endif
@@ -0,0 +1,158 @@
+/**** spi.c ********************************/
+/*   Universal RPi GPIO keyboard daemon    */
+/*                                         */
+/* spidev transport for SPI expanders      */
+/*******************************************/
+
+/*
+   This file is part of the Universal Raspberry Pi GPIO keyboard daemon.
+
+   This is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   The software is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with the GNU C Library; if not, write to the Free
+   Software Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+   02111-1307 USA.  
+*/
+
+/* The MCP23Sxx chips frame every transfer as an opcode byte (0100 A2 A1 A0
+ * R/W), a register address and then data, all while chip select is low.
+ * Up to eight chips share one chip select by their hardware address pins.
+ * Reads are full-duplex: the data comes back in the same transfer as the
+ * opcode and register, so one ioctl gets a whole register burst.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <sys/ioctl.h>
+#include <linux/spi/spidev.h>
+#include "spi.h"
+#include "debug.h"
+
+#define SPI_OPCODE(a)   (0x40 | (((a) & 7) << 1))
+#define SPI_READ        0x01
+
+static int spi_xfer(int fd, char *tx, char *rx, int n);
+
+
+/* open a spidev node in mode 0, returns the fd or -1 */
+int spi_open(const char *devName, int speed)
+{
+  int fd;
+  uint8_t mode = SPI_MODE_0;
+  uint8_t bits = 8;
+  uint32_t hz = speed;
+
+  if( (fd = open(devName, O_RDWR)) < 0 ){
+    perror(devName);
+    return -1;
+  }
+
+  if( (ioctl(fd, SPI_IOC_WR_MODE, &mode) < 0) ||
+      (ioctl(fd, SPI_IOC_WR_BITS_PER_WORD, &bits) < 0) ||
+      (ioctl(fd, SPI_IOC_WR_MAX_SPEED_HZ, &hz) < 0) ){
+    perror("spidev setup");
+    close(fd);
+    return -1;
+  }
+
+  if (debug_lvl() >= DEBUG_IIC) {
+    printf("SPI %s at %d Hz\n", devName, speed);
+  }
+
+  return fd;
+}
+
+int spi_write_reg(int fd, int hwAddr, int regno, char *buf, int n)
+{
+  char tx[SPI_BUF_SIZE];
+
+  if( (regno < 0) || (n+2 > SPI_BUF_SIZE) ){
+    return -1;
+  }
+  tx[0] = SPI_OPCODE(hwAddr);
+  tx[1] = regno;
+  memcpy(&tx[2], buf, n);
+
+  if( spi_xfer(fd, tx, NULL, n+2) < 0 ){
+    return -1;
+  }
+  return n+1;
+}
+
+/* burst read of "n" registers starting at "regno" */
+int spi_read_reg(int fd, int hwAddr, int regno, char *buf, int n)
+{
+  char tx[SPI_BUF_SIZE];
+  char rx[SPI_BUF_SIZE];
+
+  if( (regno < 0) || (n+2 > SPI_BUF_SIZE) ){
+    return -1;
+  }
+  memset(tx, 0, n+2);
+  tx[0] = SPI_OPCODE(hwAddr) | SPI_READ;
+  tx[1] = regno;
+
+  if( spi_xfer(fd, tx, rx, n+2) < 0 ){
+    return -1;
+  }
+  memcpy(buf, &rx[2], n);
+  return n;
+}
+
+/* "count" separate transfers of "n" bytes each in one ioctl, chip select
+ * is released between them.  For converters that take one channel per
+ * transfer, "tx" and "rx" hold count * n bytes.
+ */
+int spi_xfer_list(int fd, char *tx, char *rx, int n, int count)
+{
+  struct spi_ioc_transfer tr[SPI_MAX_XFERS];
+  int i, r;
+
+  if( (count < 1) || (count > SPI_MAX_XFERS) ){
+    return -1;
+  }
+  memset(tr, 0, sizeof(tr));
+  for( i=0; i<count; i++ ){
+    tr[i].tx_buf = (unsigned long)&tx[i*n];
+    tr[i].rx_buf = (unsigned long)&rx[i*n];
+    tr[i].len = n;
+    tr[i].cs_change = (i < count-1);
+  }
+
+  if( (r = ioctl(fd, SPI_IOC_MESSAGE(count), tr)) < 0 ){
+    if (debug_lvl() >= DEBUG_IIC) {
+      perror("spi transfer");
+    }
+  }
+  return r;
+}
+
+static int spi_xfer(int fd, char *tx, char *rx, int n)
+{
+  struct spi_ioc_transfer tr;
+  int r;
+
+  memset(&tr, 0, sizeof(tr));
+  tr.tx_buf = (unsigned long)tx;
+  tr.rx_buf = (unsigned long)rx;
+  tr.len = n;
+
+  if( (r = ioctl(fd, SPI_IOC_MESSAGE(1), &tr)) < 0 ){
+    if (debug_lvl() >= DEBUG_IIC) {
+      perror("spi transfer");
+    }
+  }
+  return r;
+}
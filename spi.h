@@ -0,0 +1,38 @@
+/**** spi.h ********************************/
+/*   Universal RPi GPIO keyboard daemon    */
+/*                                         */
+/* spidev transport for SPI expanders      */
+/*******************************************/
+
+/*
+   This file is part of the Universal Raspberry Pi GPIO keyboard daemon.
+
+   This is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   The software is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with the GNU C Library; if not, write to the Free
+   Software Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+   02111-1307 USA.  
+*/
+
+#ifndef _SPI_H_
+#define _SPI_H_
+
+#define SPI_SPEED       10000000        /* MCP23Sxx maximum clock */
+#define SPI_BUF_SIZE    34              /* opcode, register and 32 data bytes */
+#define SPI_MAX_XFERS   16              /* transfers in one spi_xfer_list() */
+
+int spi_open(const char *devName, int speed);
+int spi_write_reg(int fd, int hwAddr, int regno, char *buf, int n);
+int spi_read_reg(int fd, int hwAddr, int regno, char *buf, int n);
+int spi_xfer_list(int fd, char *tx, char *rx, int n, int count);
+
+#endif
@@ -0,0 +1,193 @@
+/**** stream.c *****************************/
+/*   Universal RPi GPIO keyboard daemon    */
+/*                                         */
+/* binary event stream socket              */
+/*******************************************/
+
+/*
+   This file is part of the Universal Raspberry Pi GPIO keyboard daemon.
+
+   This is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   The software is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with the GNU C Library; if not, write to the Free
+   Software Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+   02111-1307 USA.  
+*/
+
+
+
+/* Input records for local services that can't, or don't want to, read
+ * evdev.  Records gathered during a main loop pass are sent to every
+ * subscriber when the pass's uinput output is flushed.  Each client has
+ * a bounded queue for what its socket won't take yet; a client that
+ * falls further behind than that is disconnected, it never holds up
+ * the scan or the other clients.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "stream.h"
+#include "debug.h"
+
+typedef struct{
+  int fd;                               /* -1 for a free slot */
+  stream_rec_s q[STREAM_QUEUE];
+  unsigned head, tail;
+}stream_client_s;
+
+static int listen_fd = -1;
+static stream_client_s client[STREAM_CLIENTS];
+static int clients = 0;
+static stream_rec_s batch[STREAM_BATCH];
+static int batch_n = 0;
+
+
+int stream_open(const char *path) {
+
+  struct sockaddr_un addr;
+  int i;
+
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    return(-1);
+  }
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path);
+
+  listen_fd = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+  if (listen_fd < 0) {
+    return(-1);
+  }
+  unlink(path);
+  if ((bind(listen_fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) ||
+      (listen(listen_fd, STREAM_CLIENTS) < 0) ||
+      (fcntl(listen_fd, F_SETFL, O_NONBLOCK) < 0)) {
+    close(listen_fd);
+    listen_fd = -1;
+    return(-1);
+  }
+
+  for (i=0; i<STREAM_CLIENTS; i++) {
+    client[i].fd = -1;
+  }
+  return(0);
+}
+
+
+/* anyone listening, so sources can skip building raw records */
+int stream_active(void) {
+
+  return(clients);
+}
+
+
+static void drop_client(stream_client_s *c, const char *why) {
+
+  if (debug_on()) {
+    printf("Stream: client %d %s\n", c->fd, why);
+  }
+  close(c->fd);
+  c->fd = -1;
+  clients--;
+}
+
+
+/* called from the main loop as things change */
+void stream_event(int type, int source, int unit, int pin, int code,
+                  int raw, int state, unsigned long long t) {
+
+  stream_rec_s *r;
+
+  if (!clients || (code >= 0xffff)) {
+    return;
+  }
+  if (batch_n >= STREAM_BATCH) {
+    stream_flush();
+  }
+  r = &batch[batch_n++];
+  r->t = t;
+  r->code = code;
+  r->type = type;
+  r->source = source;
+  r->unit = unit;
+  r->pin = pin;
+  r->raw = raw;
+  r->state = state;
+}
+
+
+/* take in new subscribers and send the pass's records to everyone */
+void stream_flush(void) {
+
+  stream_client_s *c;
+  unsigned n;
+  int i, j, fd;
+
+  if (listen_fd < 0) {
+    return;
+  }
+
+  while ((fd = accept(listen_fd, NULL, NULL)) >= 0) {
+    for (i=0; (i < STREAM_CLIENTS) && (client[i].fd >= 0); i++);
+    if ((i == STREAM_CLIENTS) || (fcntl(fd, F_SETFL, O_NONBLOCK) < 0)) {
+      close(fd);
+      continue;
+    }
+    client[i].fd = fd;
+    client[i].head = client[i].tail = 0;
+    clients++;
+    if (debug_on()) {
+      printf("Stream: client %d connected\n", fd);
+    }
+  }
+
+  for (i=0; i<STREAM_CLIENTS; i++) {
+    c = &client[i];
+    if (c->fd < 0) {
+      continue;
+    }
+
+    if (c->head - c->tail + batch_n > STREAM_QUEUE) {
+      drop_client(c, "too slow, disconnected");
+      continue;
+    }
+    for (j=0; j<batch_n; j++) {
+      c->q[(c->head + j) % STREAM_QUEUE] = batch[j];
+    }
+    c->head += batch_n;
+
+    while (c->tail != c->head) {
+      n = c->head - c->tail;
+      if (n > STREAM_MSG) {
+        n = STREAM_MSG;
+      }
+      if ((c->tail % STREAM_QUEUE) + n > STREAM_QUEUE) {
+        n = STREAM_QUEUE - (c->tail % STREAM_QUEUE);
+      }
+      if (send(c->fd, &c->q[c->tail % STREAM_QUEUE], n * sizeof(stream_rec_s),
+               MSG_DONTWAIT | MSG_NOSIGNAL) < 0) {
+        if ((errno != EAGAIN) && (errno != EWOULDBLOCK)) {
+          drop_client(c, "closed");
+        }
+        break;
+      }
+      c->tail += n;
+    }
+  }
+  batch_n = 0;
+}
@@ -0,0 +1,72 @@
+/**** stream.h *****************************/
+/*   Universal RPi GPIO keyboard daemon    */
+/*                                         */
+/* binary event stream socket              */
+/*******************************************/
+
+/*
+   This file is part of the Universal Raspberry Pi GPIO keyboard daemon.
+
+   This is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   The software is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with the GNU C Library; if not, write to the Free
+   Software Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+   02111-1307 USA.  
+*/
+
+
+
+#ifndef _STREAM_H_
+#define _STREAM_H_
+
+#define STREAM_PATH     "/var/run/pikeyd.sock"
+#define STREAM_CLIENTS  8
+#define STREAM_BATCH    256     /* records gathered in one main loop pass */
+#define STREAM_QUEUE    1024    /* records a client may fall behind, power of 2 */
+#define STREAM_MSG      64      /* most records in one message */
+
+/* record types */
+#define STREAM_KEY      0       /* debounced change of a key */
+#define STREAM_RAW      1       /* sampled level of a pin changed */
+
+/* record sources, "unit" is the group, expander, receiver, ADC or counter */
+#define STREAM_GPIO     0
+#define STREAM_MATRIX   1
+#define STREAM_XIO      2
+#define STREAM_EDGE     3       /* encoders and PS/2 keyboards */
+#define STREAM_IR       4
+#define STREAM_ADC      5
+#define STREAM_COUNTER  6
+
+#define STREAM_NO_PIN   0xff
+
+/* Each SOCK_SEQPACKET message is an array of these, 16 bytes each, in
+ * the order things happened within a main loop pass.
+ */
+typedef struct{
+  unsigned long long t;         /* sample time, CLOCK_MONOTONIC microseconds */
+  unsigned short code;          /* key code, 0 for raw records */
+  unsigned char type;           /* STREAM_KEY or STREAM_RAW */
+  unsigned char source;
+  unsigned char unit;
+  unsigned char pin;
+  unsigned char raw;            /* sampled level, 1 when active (low) */
+  unsigned char state;          /* debounced state, 1 when down */
+}stream_rec_s;
+
+int stream_open(const char *path);
+int stream_active(void);
+void stream_event(int type, int source, int unit, int pin, int code,
+                  int raw, int state, unsigned long long t);
+void stream_flush(void);
+
+#endif
@@ -0,0 +1,205 @@
+/**** adc_replay.c *************************/
+/*   Universal RPi GPIO keyboard daemon    */
+/*                                         */
+/* ADC reading replay                      */
+/*******************************************/
+
+/*
+   This file is part of the Universal Raspberry Pi GPIO keyboard daemon.
+
+   This is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   The software is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with the GNU C Library; if not, write to the Free
+   Software Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+   02111-1307 USA.  
+*/
+
+
+/* Replays converter readings through adc_sample() the way the sampling
+ * thread hands them over, then runs adc_poll() to see what goes out: the
+ * IIR filter and hysteresis on an axis, resistor ladder windows and rapid
+ * trigger presses with the time of the crossing reading.  spi.c is
+ * replaced by a stub, nothing is ever read from a device.
+ */
+
+#include <stdio.h>
+#include <linux/input.h>
+#include "config.h"
+#include "gpio.h"
+#include "spi.h"
+#include "adc.h"
+#include "uinput.h"
+#include "keystate.h"
+#include "stream.h"
+#include "debug.h"
+#include "test.h"
+
+/* the rest of the daemon, as far as adc.c needs it */
+
+static unsigned long long now = 1000000;
+static unsigned long long stamp;
+static unsigned long long key_stamp[16];   /* stamp each key went out with */
+static int keys[16], abs_v[16];
+static int key_cnt = 0, abs_cnt = 0;
+
+int debug_on(void) { return 0; }
+int spi_open(const char *devName, int speed) { return 3; }
+int spi_xfer_list(int fd, char *tx, char *rx, int n, int count) { return -1; }
+unsigned long long gpio_time_us(void) { return now; }
+void uinput_stamp(unsigned long long t) { stamp = t; }
+void uinput_use_abs(int code, int min, int max, int fuzz, int flat) { }
+int uinput_lat_key(int code) { return 0; }
+int uinput_key_latency(int code, unsigned long *n, unsigned long long *sum, unsigned *max) { return -1; }
+void keystate_set(int code, int down, unsigned long long t) { }
+void stream_event(int type, int source, int unit, int pin, int code,
+                  int raw, int state, unsigned long long t) { }
+
+/* keys are logged as code * 2 + value */
+int sendKey(int key, int value)
+{
+  if(key_cnt < 16){
+    key_stamp[key_cnt] = stamp;
+    keys[key_cnt++] = key * 2 + value;
+  }
+  return 0;
+}
+
+int sendAbs(int code, int value)
+{
+  if(abs_cnt < 16){
+    abs_v[abs_cnt++] = value;
+  }
+  return 0;
+}
+
+/* "n" readings of "raw" on one channel, 1ms apart */
+static void feed(int adc, int ch, int raw, int n)
+{
+  while(n--){
+    now += 1000;
+    adc_sample(adc, ch, raw, now);
+  }
+}
+
+int main(void)
+{
+  int adc = adc_add("ADC0", "MCP3008", "/dev/spidev0.1", 0);
+  unsigned long long t_press = 0;
+  int i;
+
+  CHECK_EQ(adc, 0);
+  CHECK_EQ(adc_range(adc), 1023);
+  CHECK_EQ(adc_axis(adc, 0, ABS_X), 0);
+  CHECK_EQ(adc_axis(adc, 3, ABS_Y), 0);
+  CHECK_EQ(adc_key(adc, 1, 100, 200, KEY_A), 0);
+  CHECK_EQ(adc_key(adc, 1, 300, 400, KEY_B), 0);
+  CHECK_EQ(adc_rapid(adc, 2, 500, 100, KEY_Z), 0);
+
+  /* nothing is sent before a channel has a first reading */
+  adc_poll();
+  CHECK_EQ(abs_cnt, 0);
+
+  /* the first reading loads the filter, then each one moves it 1/4 */
+  feed(adc, 0, 0, 1);
+  adc_poll();
+  feed(adc, 0, 1000, 1);
+  adc_poll();
+  feed(adc, 0, 1000, 1);
+  adc_poll();
+  feed(adc, 0, 1000, 1);
+  adc_poll();
+  CHECK_EQ(abs_cnt, 4);
+  CHECK_EQ(abs_v[0], 0);
+  CHECK_EQ(abs_v[1], 250);
+  CHECK_EQ(abs_v[2], 437);
+  CHECK_EQ(abs_v[3], 578);
+
+  /* it settles within the hysteresis (4 counts on a 10 bit converter) */
+  feed(adc, 0, 1000, 40);
+  adc_poll();
+  CHECK(abs_v[abs_cnt - 1] >= 996);
+
+  /* noise that moves the filtered value by less than that is not sent,
+   * a real move is */
+  abs_cnt = 0;
+  feed(adc, 3, 512, 1);
+  adc_poll();
+  CHECK_EQ(abs_cnt, 1);
+  CHECK_EQ(abs_v[0], 512);
+  for(i=0; i<20; i++){
+    feed(adc, 3, (i & 1) ? 516 : 508, 1);
+    adc_poll();
+  }
+  CHECK_EQ(abs_cnt, 1);
+  feed(adc, 3, 530, 1);
+  adc_poll();
+  CHECK_EQ(abs_cnt, 2);
+  CHECK_EQ(abs_v[1], 516);
+
+  /* ladder keys: a window is held while the reading is inside it, and
+   * a reading just outside the active one doesn't drop it */
+  feed(adc, 1, 150, 1);
+  adc_poll();
+  CHECK_EQ(key_cnt, 1);
+  CHECK_EQ(keys[0], KEY_A * 2 + 1);
+  feed(adc, 1, 203, 10);
+  adc_poll();
+  CHECK_EQ(key_cnt, 1);
+  feed(adc, 1, 350, 20);
+  adc_poll();
+  CHECK_EQ(key_cnt, 3);
+  CHECK_EQ(keys[1], KEY_A * 2);
+  CHECK_EQ(keys[2], KEY_B * 2 + 1);
+  feed(adc, 1, 1000, 20);
+  adc_poll();
+  CHECK_EQ(key_cnt, 4);
+  CHECK_EQ(keys[3], KEY_B * 2);
+
+  /* rapid trigger: learn the rest position, press on the way down and
+   * release 10% back up from the deepest point, re-press 10% down again */
+  key_cnt = 0;
+  feed(adc, 2, 100, ADC_RT_CAL);
+  adc_poll();
+  CHECK_EQ(key_cnt, 0);
+  for(i=110; i<=900; i+=10){
+    feed(adc, 2, i, 1);
+    adc_poll();
+    if( key_cnt && !t_press ){
+      t_press = now;
+    }
+  }
+  CHECK_EQ(key_cnt, 1);
+  CHECK(t_press && (t_press < now));   /* well before the bottom */
+  CHECK_EQ(keys[0], KEY_Z * 2 + 1);
+  CHECK_EQ(key_stamp[0], t_press);
+  feed(adc, 2, 850, 1);              /* 6% up, still down */
+  adc_poll();
+  CHECK_EQ(key_cnt, 1);
+  feed(adc, 2, 800, 1);              /* 12.5% up from the bottom */
+  adc_poll();
+  CHECK_EQ(key_cnt, 2);
+  CHECK_EQ(keys[1], KEY_Z * 2);
+  CHECK_EQ(key_stamp[1], now);
+  feed(adc, 2, 760, 1);              /* still going up */
+  feed(adc, 2, 820, 1);              /* 7.5% down from the top */
+  adc_poll();
+  CHECK_EQ(key_cnt, 2);
+  feed(adc, 2, 850, 1);              /* 11% down */
+  adc_poll();
+  CHECK_EQ(key_cnt, 3);
+  CHECK_EQ(keys[2], KEY_Z * 2 + 1);
+  feed(adc, 2, 100, 1);
+  adc_poll();
+  CHECK_EQ(key_cnt, 4);
+
+  return TEST_DONE("adc_replay");
+}
@@ -0,0 +1,183 @@
+/**** bench_macro.c ************************/
+/*   Universal RPi GPIO keyboard daemon    */
+/*                                         */
+/* uinput batching benchmark               */
+/*******************************************/
+
+/*
+   This file is part of the Universal Raspberry Pi GPIO keyboard daemon.
+
+   This is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   The software is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with the GNU C Library; if not, write to the Free
+   Software Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+   02111-1307 USA.  
+*/
+
+
+
+/* Plays multi key pins through send_gpio_keys() and uinput_flush() into
+ * a stand-in /dev/uinput and counts what the writer hands the kernel:
+ * write() calls, and SYN_REPORTs, each of which wakes every reader of
+ * the device.  The same keys are then sent the old way, a write() for
+ * each event and another for its SYN, for comparison.  Run with:
+ * make bench
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <linux/input.h>
+#include "config.h"
+#include "gpio.h"
+#include "iic.h"
+#include "uinput.h"
+#include "macro.h"
+#include "stream.h"
+#include "debug.h"
+
+#define BENCH_RUNS      200
+#define BENCH_KEY       KEY_1           /* first key of a pin */
+
+static const int bench_keys[] = { 1, 4, 10, 32 };
+
+static int fake_fd = -1;
+static int key_n = 0, key_i = 0;        /* keys on the pin, next one */
+static volatile unsigned long n_writes = 0;
+static volatile unsigned long n_syns = 0;
+
+/* the rest of the daemon, as far as uinput.c needs it */
+
+int debug_lvl(void) { return 0; }
+int debug_on(void) { return 0; }
+unsigned long long gpio_time_us(void) { return 0; }
+void restart_keys(int grp) { key_i = 0; }
+int got_more_keys(int grp, int gpio) { return key_i < key_n; }
+int get_next_key(int grp, int gpio) { return BENCH_KEY + key_i++; }
+int is_xio(int gpio) { return 0; }
+int get_curr_xio_no(void) { return 0; }
+void poll_iic(int xio) { }
+int macro_play(int key) { return 0; }
+int macro_is_key(int key) { return 0; }
+void stream_flush(void) { }
+
+/* /dev/uinput is /dev/null, its ioctls all succeed */
+
+int __real_open(const char *path, int flags, ...);
+int __wrap_open(const char *path, int flags, ...);
+int __wrap_ioctl(int fd, unsigned long req, ...);
+ssize_t __real_write(int fd, const void *buf, size_t n);
+ssize_t __wrap_write(int fd, const void *buf, size_t n);
+
+int __wrap_open(const char *path, int flags, ...)
+{
+  if (strcmp(path, "/dev/uinput") == 0) {
+    return(fake_fd = __real_open("/dev/null", O_WRONLY));
+  }
+  return(__real_open(path, flags, 0));
+}
+
+int __wrap_ioctl(int fd, unsigned long req, ...)
+{
+  return(0);
+}
+
+ssize_t __wrap_write(int fd, const void *buf, size_t n)
+{
+  const struct input_event *ev = buf;
+  size_t i;
+
+  if (fd == fake_fd) {
+    for (i=0; i<n / sizeof(struct input_event); i++) {
+      if ((ev[i].type == EV_SYN) && (ev[i].code == SYN_REPORT)) {
+        n_syns++;
+      }
+    }
+    __sync_synchronize();
+    n_writes++;
+  }
+  return(__real_write(fd, buf, n));
+}
+
+/* the writer is done with a pass once it has written and gone quiet */
+static void writer_wait(unsigned long writes)
+{
+  int i;
+
+  for (i=0; (i < 1000) && (n_writes == writes); i++) {
+    usleep(100);
+  }
+  usleep(1000);
+}
+
+/* what sendKey() and sendSync() did before batching */
+static void old_event(int type, int code, int value)
+{
+  struct input_event ev;
+
+  memset(&ev, 0, sizeof(ev));
+  ev.type = type;
+  ev.code = code;
+  ev.value = value;
+  write(fake_fd, &ev, sizeof(ev));
+}
+
+static void old_key(int key, int value)
+{
+  old_event(EV_KEY, key, value);
+  old_event(EV_SYN, SYN_REPORT, 0);
+}
+
+int main(void)
+{
+  unsigned long w, s;
+  int i, k, run;
+
+  for (i=0; i<bench_keys[sizeof(bench_keys) / sizeof(bench_keys[0]) - 1]; i++) {
+    uinput_use_key(BENCH_KEY + i);
+  }
+  if (!init_uinput()) {
+    return(1);
+  }
+
+  printf("keys  per event: writes wakeups  batched: writes wakeups\n");
+  for (i=0; i<(int) (sizeof(bench_keys) / sizeof(bench_keys[0])); i++) {
+    key_n = bench_keys[i];
+
+    /* one write per event */
+    w = n_writes;
+    s = n_syns;
+    for (run=0; run<BENCH_RUNS; run++) {
+      for (k=0; k<key_n; k++) {
+        old_key(BENCH_KEY + k, 1);
+        old_key(BENCH_KEY + k, 0);
+      }
+    }
+    printf("%4d  %17.1f %7.1f", key_n, (double) (n_writes - w) / BENCH_RUNS,
+           (double) (n_syns - s) / BENCH_RUNS);
+
+    /* queued by the scan, written by the writer */
+    w = n_writes;
+    s = n_syns;
+    for (run=0; run<BENCH_RUNS; run++) {
+      send_gpio_keys(0, 0);
+      uinput_flush();
+      writer_wait(n_writes);
+    }
+    printf("  %16.1f %7.1f\n", (double) (n_writes - w) / BENCH_RUNS,
+           (double) (n_syns - s) / BENCH_RUNS);
+  }
+
+  close_uinput();
+  return(0);
+}
@@ -0,0 +1,134 @@
+/**** gpio_replay.c ************************/
+/*   Universal RPi GPIO keyboard daemon    */
+/*                                         */
+/* GPIO pin level replay                   */
+/*******************************************/
+
+/*
+   This file is part of the Universal Raspberry Pi GPIO keyboard daemon.
+
+   This is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   The software is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with the GNU C Library; if not, write to the Free
+   Software Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+   02111-1307 USA.  
+*/
+
+
+
+/* Replays pin levels through gpio_poll() on a direct pin group, with the
+ * GPIO registers in an array instead of /dev/mem.  Held keys must follow
+ * the debounced state: a held pin that glitches high, or a released pin
+ * that glitches low, sends nothing, so a macro on the pin is not played
+ * again.  Without held keys a press still sends the pin's keys once.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "gpio.h"
+#include "config.h"
+#include "uinput.h"
+#include "keystate.h"
+#include "stream.h"
+#include "debug.h"
+#include "test.h"
+
+#define PIN 4
+
+extern volatile unsigned *GPIO;
+
+static unsigned regs[64];
+static mat_grp_s grp0;
+static int holding = 0;
+static int downs = 0, ups = 0, presses = 0;
+
+/* the rest of the daemon, as far as gpio.c needs it */
+
+int debug_lvl(void) { return 0; }
+mat_grp_s *get_matgrp(int grp) { return &grp0; }
+int is_xio(int gpio) { return 0; }
+void keystate_set(int code, int down, unsigned long long t) { }
+int stream_active(void) { return 0; }
+void stream_event(int type, int source, int unit, int pin, int code,
+                  int raw, int state, unsigned long long t) { }
+int uinput_holding(void) { return holding; }
+void uinput_stamp(unsigned long long t) { }
+
+/* a key down on a macro pin is what plays its macro */
+int send_gpio_state(int grp, int gpio, int value)
+{
+  if (value) {
+    downs++;
+  }
+  else {
+    ups++;
+  }
+  return 0;
+}
+
+int send_gpio_keys(int grp, int gpio)
+{
+  presses++;
+  return 0;
+}
+
+/* "n" polls with the pin at "level", switches pull it low when down */
+static void poll(int level, int n)
+{
+  regs[13] = level ? (1 << PIN) : 0;
+  while (n--) {
+    gpio_poll(0);
+  }
+}
+
+static void reset(void)
+{
+  memset(&grp0, 0, sizeof(grp0));
+  grp0.gpio = -1;
+  grp0.gpio_mask = grp0.last_gpio = 1 << PIN;
+  downs = ups = presses = 0;
+}
+
+int main(void)
+{
+  GPIO = regs;
+
+  /* held: press, glitch while held, release, glitch while released */
+  holding = 1;
+  reset();
+  poll(1, 4);
+  poll(0, 4);
+  CHECK_EQ(downs, 1);
+  CHECK_EQ(ups, 0);
+  poll(1, 1);
+  poll(0, 4);
+  CHECK_EQ(downs, 1);
+  CHECK_EQ(ups, 0);
+  poll(1, 4);
+  CHECK_EQ(downs, 1);
+  CHECK_EQ(ups, 1);
+  poll(0, 1);
+  poll(1, 4);
+  CHECK_EQ(downs, 1);
+  CHECK_EQ(ups, 1);
+  CHECK_EQ(presses, 0);
+
+  /* not held: a press sends the keys once, the release nothing */
+  holding = 0;
+  reset();
+  poll(0, 4);
+  poll(1, 4);
+  CHECK_EQ(presses, 1);
+  CHECK_EQ(downs + ups, 0);
+
+  return TEST_DONE("gpio_replay");
+}
@@ -0,0 +1,244 @@
+/**** ir_replay.c **************************/
+/*   Universal RPi GPIO keyboard daemon    */
+/*                                         */
+/* IR decoder trace replay                 */
+/*******************************************/
+
+/*
+   This file is part of the Universal Raspberry Pi GPIO keyboard daemon.
+
+   This is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   The software is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with the GNU C Library; if not, write to the Free
+   Software Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+   02111-1307 USA.  
+*/
+
+
+/* Feeds synthetic receiver traces for NEC, RC5 and RC6 through ir_pulse()
+ * and checks the keys ir_poll() sends: a press on a new frame, held across
+ * repeat frames, released IR_HOLD_US after the last one.  Traces are built
+ * from the protocol timings so each case states the frame it carries.
+ */
+
+#include <stdio.h>
+#include <linux/input.h>
+#include "config.h"
+#include "gpio.h"
+#include "edge.h"
+#include "ir.h"
+#include "uinput.h"
+#include "keystate.h"
+#include "stream.h"
+#include "debug.h"
+#include "test.h"
+
+/* the rest of the daemon, as far as ir.c needs it */
+
+static unsigned long long now = 1000000;
+static int sent[16];
+static int sent_cnt = 0;
+
+int debug_on(void) { return 0; }
+int edge_add(int pin, edge_fn fn, void *ctx) { return 0; }
+unsigned long long gpio_time_us(void) { return now; }
+void uinput_stamp(unsigned long long t) { }
+void keystate_set(int code, int down, unsigned long long t) { }
+void stream_event(int type, int source, int unit, int pin, int code,
+                  int raw, int state, unsigned long long t) { }
+
+/* keys are logged as code * 2 + value */
+int sendKey(int key, int value)
+{
+  if(sent_cnt < 16){
+    sent[sent_cnt++] = key * 2 + value;
+  }
+  return 0;
+}
+
+static void pulse(int ir, int mark, unsigned d)
+{
+  now += d;
+  ir_pulse(ir, mark, d, now);
+}
+
+/* NEC: leader, 32 bits LSB first, final mark */
+static void nec_frame(int ir, unsigned data)
+{
+  int i;
+
+  pulse(ir, 1, 9000);
+  pulse(ir, 0, 4500);
+  for(i=0; i<32; i++){
+    pulse(ir, 1, 562);
+    pulse(ir, 0, ((data >> i) & 1) ? 1687 : 562);
+  }
+  pulse(ir, 1, 562);
+}
+
+static void nec_repeat(int ir)
+{
+  pulse(ir, 0, 40000);
+  pulse(ir, 1, 9000);
+  pulse(ir, 0, 2250);
+  pulse(ir, 1, 562);
+}
+
+/* Manchester half bits (1 = mark) as merged pulses of "t" us each; a
+ * leading space is idle line and a trailing one is only the end of the
+ * frame, neither is seen as a pulse */
+static void halves(int ir, const unsigned char *h, int n, unsigned t)
+{
+  int i = 0, run;
+
+  while( (i < n) && !h[i] ){
+    i++;
+  }
+  while(i < n){
+    for(run=1; (i + run < n) && (h[i + run] == h[i]); run++);
+    if( h[i] || (i + run < n) ){
+      pulse(ir, h[i], run * t);
+    }
+    i += run;
+  }
+}
+
+/* RC5: start, field, toggle, 5 bit address, 6 bit command, one = space
+ * mark.  The field bit is the inverted command bit 6 of RC5X. */
+static void rc5_frame(int ir, int toggle, int addr, int cmd)
+{
+  unsigned char h[28];
+  int bits = 0x2000 | (!(cmd & 0x40) << 12) | (toggle << 11) | (addr << 6) | (cmd & 0x3f);
+  int i;
+
+  for(i=0; i<14; i++){
+    h[2*i] = !((bits >> (13 - i)) & 1);
+    h[2*i+1] = !h[2*i];
+  }
+  pulse(ir, 0, 100000);
+  halves(ir, h, 28, 889);
+}
+
+/* RC6 mode 0: leader, start 1, mode 000, double length toggle, 8+8 bits,
+ * one = mark space */
+static void rc6_frame(int ir, int toggle, int addr, int cmd)
+{
+  unsigned char h[44];
+  int bits = (addr << 8) | cmd;
+  int i;
+
+  h[0] = 1;
+  h[1] = 0;
+  for(i=1; i<4; i++){
+    h[2*i] = 0;
+    h[2*i+1] = 1;
+  }
+  h[8] = h[9] = toggle;
+  h[10] = h[11] = !toggle;
+  for(i=0; i<16; i++){
+    h[12+2*i] = (bits >> (15 - i)) & 1;
+    h[13+2*i] = !h[12+2*i];
+  }
+  pulse(ir, 0, 100000);
+  pulse(ir, 1, 2666);
+  pulse(ir, 0, 889);
+  halves(ir, h, 44, 444);
+}
+
+/* let the held key time out */
+static void idle(void)
+{
+  now += IR_HOLD_US + 1000;
+  ir_poll();
+}
+
+int main(void)
+{
+  int ir = ir_add("IR0", 17);
+
+  CHECK_EQ(ir, 0);
+  CHECK_EQ(ir_find_proto("RC6"), IR_RC6);
+  ir_map(ir, IR_NEC, 0x04, 0x08, KEY_VOLUMEUP);
+  ir_map(ir, IR_NEC, 0x7f04, 0x10, KEY_VOLUMEDOWN);
+  ir_map(ir, IR_RC5, 0x05, 0x35, KEY_PLAY);
+  ir_map(ir, IR_RC5, 0x00, 0x41, KEY_STOP);
+  ir_map(ir, IR_RC6, 0x00, 0x0c, KEY_POWER);
+
+  /* NEC, held with two repeat codes, then released */
+  nec_frame(ir, 0x04 | (0xfb << 8) | (0x08 << 16) | (0xf7u << 24));
+  ir_poll();
+  nec_repeat(ir);
+  nec_repeat(ir);
+  ir_poll();
+  CHECK_EQ(sent_cnt, 1);
+  CHECK_EQ(sent[0], KEY_VOLUMEUP * 2 + 1);
+  idle();
+  CHECK_EQ(sent_cnt, 2);
+  CHECK_EQ(sent[1], KEY_VOLUMEUP * 2);
+
+  /* extended NEC has a 16 bit address */
+  sent_cnt = 0;
+  nec_frame(ir, 0x7f04 | (0x10 << 16) | (0xefu << 24));
+  idle();
+  CHECK_EQ(sent_cnt, 2);
+  CHECK_EQ(sent[0], KEY_VOLUMEDOWN * 2 + 1);
+
+  /* a command that doesn't match its inverse is dropped */
+  sent_cnt = 0;
+  nec_frame(ir, 0x04 | (0xfb << 8) | (0x08 << 16) | (0xf6u << 24));
+  idle();
+  CHECK_EQ(sent_cnt, 0);
+
+  /* RC5: the same toggle is a held button, a new toggle a new press */
+  sent_cnt = 0;
+  rc5_frame(ir, 0, 0x05, 0x35);
+  rc5_frame(ir, 0, 0x05, 0x35);
+  ir_poll();
+  CHECK_EQ(sent_cnt, 1);
+  rc5_frame(ir, 1, 0x05, 0x35);
+  ir_poll();
+  CHECK_EQ(sent_cnt, 3);
+  CHECK_EQ(sent[1], KEY_PLAY * 2);
+  CHECK_EQ(sent[2], KEY_PLAY * 2 + 1);
+  idle();
+  CHECK_EQ(sent_cnt, 4);
+
+  /* RC5X: a cleared field bit is command bit 6 */
+  sent_cnt = 0;
+  rc5_frame(ir, 0, 0x00, 0x41);
+  idle();
+  CHECK_EQ(sent_cnt, 2);
+  CHECK_EQ(sent[0], KEY_STOP * 2 + 1);
+
+  /* RC6 mode 0 with both toggle values */
+  sent_cnt = 0;
+  rc6_frame(ir, 1, 0x00, 0x0c);
+  ir_poll();
+  CHECK_EQ(sent_cnt, 1);
+  CHECK_EQ(sent[0], KEY_POWER * 2 + 1);
+  rc6_frame(ir, 0, 0x00, 0x0c);
+  idle();
+  CHECK_EQ(sent_cnt, 4);
+  CHECK_EQ(sent[3], KEY_POWER * 2);
+
+  /* a frame cut short decodes as nothing */
+  sent_cnt = 0;
+  pulse(ir, 0, 100000);
+  pulse(ir, 1, 2666);
+  pulse(ir, 0, 889);
+  pulse(ir, 1, 444);
+  pulse(ir, 0, 30000);
+  idle();
+  CHECK_EQ(sent_cnt, 0);
+
+  return TEST_DONE("ir_replay");
+}
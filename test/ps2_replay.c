@@ -0,0 +1,176 @@
+/**** ps2_replay.c *************************/
+/*   Universal RPi GPIO keyboard daemon    */
+/*                                         */
+/* PS/2 receiver stream replay             */
+/*******************************************/
+
+/*
+   This file is part of the Universal Raspberry Pi GPIO keyboard daemon.
+
+   This is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   The software is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with the GNU C Library; if not, write to the Free
+   Software Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+   02111-1307 USA.  
+*/
+
+
+/* Replays clock edge streams through ps2_clock() as the edge thread would
+ * and checks the key changes posted for the main loop, the frame error
+ * count and that the receiver picks up again after a bad frame.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <linux/input.h>
+#include "config.h"
+#include "edge.h"
+#include "ps2.h"
+#include "uinput.h"
+#include "debug.h"
+#include "test.h"
+
+#define CLK_US  80                /* 12.5kHz clock */
+
+/* the rest of the daemon, as far as ps2.c needs it */
+
+static int debug = 0;
+static int posted[32];
+static int post_cnt = 0;
+
+int debug_on(void) { return debug; }
+int edge_add(int pin, edge_fn fn, void *ctx) { return 0; }
+int edge_level(int pin) { return 1; }
+void uinput_use_key(int code) { }
+
+/* keys are logged as code * 2 + value */
+int edge_post(int type, int code, int value, unsigned long long t)
+{
+  if( (type == EV_KEY) && (post_cnt < 32) ){
+    posted[post_cnt++] = code * 2 + value;
+  }
+  return 0;
+}
+
+static unsigned long long now = 1000000;
+
+/* one 11 bit frame, "parity" flips the parity bit to make a bad frame */
+static void frame(int code, int parity)
+{
+  unsigned f = code << 1;
+  int i, ones = 0;
+
+  for(i=0; i<8; i++){
+    ones += (code >> i) & 1;
+  }
+  f |= (!(ones & 1) ^ parity) << 9;
+  f |= 1 << 10;
+  for(i=0; i<11; i++){
+    ps2_clock(0, (f >> i) & 1, now);
+    now += CLK_US;
+  }
+  now += 500;                     /* gap between bytes */
+}
+
+static void bytes(const unsigned char *b, int n)
+{
+  int i;
+
+  for(i=0; i<n; i++){
+    frame(b[i], 0);
+  }
+}
+
+/* what ps2_report() prints with -D */
+static char *report(void)
+{
+  static char buf[256];
+  FILE *out = stdout;
+
+  memset(buf, 0, sizeof(buf));
+  stdout = fmemopen(buf, sizeof(buf) - 1, "w");
+  debug = 1;
+  ps2_report();
+  debug = 0;
+  fclose(stdout);
+  stdout = out;
+  return buf;
+}
+
+int main(void)
+{
+  const unsigned char a[] = { 0x1c, 0x1c, 0x1c, 0xf0, 0x1c };
+  const unsigned char up[] = { 0xe0, 0x75, 0xe0, 0xf0, 0x75 };
+  const unsigned char prtsc[] = { 0xe0, 0x12, 0xe0, 0x7c, 0xe0, 0xf0, 0x7c, 0xe0, 0xf0, 0x12 };
+  const unsigned char pause[] = { 0xe1, 0x14, 0x77, 0xe1, 0xf0, 0x14, 0xf0, 0x77, 0x16 };
+
+  CHECK_EQ(ps2_add("KBD", 2, 3), 0);
+
+  /* make, typematic repeats dropped, then the F0 break code */
+  bytes(a, sizeof(a));
+  CHECK_EQ(post_cnt, 2);
+  CHECK_EQ(posted[0], KEY_A * 2 + 1);
+  CHECK_EQ(posted[1], KEY_A * 2);
+
+  /* E0 prefixed make and break */
+  post_cnt = 0;
+  bytes(up, sizeof(up));
+  CHECK_EQ(post_cnt, 2);
+  CHECK_EQ(posted[0], KEY_UP * 2 + 1);
+  CHECK_EQ(posted[1], KEY_UP * 2);
+
+  /* Print Screen with its fake shifts is just SysRq */
+  post_cnt = 0;
+  bytes(prtsc, sizeof(prtsc));
+  CHECK_EQ(post_cnt, 2);
+  CHECK_EQ(posted[0], KEY_SYSRQ * 2 + 1);
+  CHECK_EQ(posted[1], KEY_SYSRQ * 2);
+
+  /* Pause has no break, the rest of its sequence is skipped */
+  post_cnt = 0;
+  bytes(pause, sizeof(pause));
+  CHECK_EQ(post_cnt, 3);
+  CHECK_EQ(posted[0], KEY_PAUSE * 2 + 1);
+  CHECK_EQ(posted[1], KEY_PAUSE * 2);
+  CHECK_EQ(posted[2], KEY_1 * 2 + 1);
+  frame(0xf0, 0);
+  frame(0x16, 0);
+  CHECK_EQ(strlen(report()), 0);       /* nothing bad seen yet */
+
+  /* a parity error drops the byte and is counted, the next one decodes */
+  post_cnt = 0;
+  frame(0x1b, 1);
+  frame(0x1b, 0);
+  CHECK_EQ(post_cnt, 1);
+  CHECK_EQ(posted[0], KEY_S * 2 + 1);
+  CHECK(strstr(report(), "1 frame errors in") != NULL);
+
+  /* a frame cut off part way is thrown out after the gap */
+  post_cnt = 0;
+  ps2_clock(0, 0, now);
+  ps2_clock(0, 1, now + CLK_US);
+  now += PS2_FRAME_US * 2;
+  frame(0xf0, 0);
+  frame(0x1b, 0);
+  CHECK_EQ(post_cnt, 1);
+  CHECK_EQ(posted[0], KEY_S * 2);
+  CHECK(strstr(report(), "2 frame errors in") != NULL);
+
+  /* unknown codes are reported, not sent */
+  post_cnt = 0;
+  frame(0x02, 0);
+  CHECK_EQ(post_cnt, 0);
+  CHECK(strstr(report(), "unknown scan code 02") != NULL);
+
+  return TEST_DONE("ps2_replay");
+}
@@ -0,0 +1,57 @@
+/**** test.h *******************************/
+/*   Universal RPi GPIO keyboard daemon    */
+/*                                         */
+/* host side test helpers                  */
+/*******************************************/
+
+/*
+   This file is part of the Universal Raspberry Pi GPIO keyboard daemon.
+
+   This is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   The software is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with the GNU C Library; if not, write to the Free
+   Software Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+   02111-1307 USA.  
+*/
+
+
+#ifndef _TEST_H_
+#define _TEST_H_
+
+#include <stdio.h>
+
+/* The tests link the modules they cover with their own stand-ins for the
+ * rest of the daemon and run on the build host, no Pi needed.  CHECK()
+ * reports a failure and carries on so one run shows every broken case.
+ */
+static int test_fails = 0;
+
+#define CHECK(c) do { \
+    if (!(c)) { \
+      printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #c); \
+      test_fails++; \
+    } \
+  } while (0)
+
+#define CHECK_EQ(a, b) do { \
+    long long a_ = (long long)(a), b_ = (long long)(b); \
+    if (a_ != b_) { \
+      printf("%s:%d: %s is %lld, expected %lld\n", __FILE__, __LINE__, #a, a_, b_); \
+      test_fails++; \
+    } \
+  } while (0)
+
+/* exit status for main() */
+#define TEST_DONE(name) \
+  (printf("%s: %s\n", name, test_fails ? "FAILED" : "ok"), test_fails ? 1 : 0)
+
+#endif
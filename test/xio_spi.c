@@ -0,0 +1,296 @@
+/**** xio_spi.c ****************************/
+/*   Universal RPi GPIO keyboard daemon    */
+/*                                         */
+/* MCP23S17 on an emulated spidev          */
+/*******************************************/
+
+/*
+   This file is part of the Universal Raspberry Pi GPIO keyboard daemon.
+
+   This is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   The software is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with the GNU C Library; if not, write to the Free
+   Software Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+   02111-1307 USA.  
+*/
+
+
+/* Runs the MCP23Sxx driver through iic.c and spi.c against MCP23S17
+ * chips emulated behind a fake spidev.  The link wraps open() and ioctl()
+ * so spi_open() gets a dummy fd and every SPI_IOC_MESSAGE is decoded by
+ * the emulation: opcode, register, then a sequential register burst, with
+ * the IOCON.BANK and IOCON.HAEN behaviour of the real part.
+ */
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <linux/spi/spidev.h>
+#include "config.h"
+#include "iic.h"
+#include "xio.h"
+#include "gpio.h"
+#include "debug.h"
+#include "test.h"
+
+#define FAKE_FD   100
+#define FAKE_CHIPS 8
+
+/* one MCP23S17, both ports kept in the MCP23008 (BANK=1) register order */
+typedef struct{
+  int present;
+  int bank;                       /* IOCON.BANK */
+  int haen;                       /* IOCON.HAEN */
+  unsigned char reg[2][11];
+  int pins;                       /* input levels, port B in the high byte */
+  int irq[2];                     /* interrupt pending per port */
+  unsigned xfers;                 /* transfers addressed to this chip */
+}fake_mcp_s;
+
+static fake_mcp_s chip[FAKE_CHIPS];
+
+int __real_open(const char *path, int flags, ...);
+int __wrap_open(const char *path, int flags, ...);
+int __real_ioctl(int fd, unsigned long req, ...);
+int __wrap_ioctl(int fd, unsigned long req, ...);
+
+int __wrap_open(const char *path, int flags, ...)
+{
+  va_list ap;
+  int mode;
+
+  if( !strncmp(path, "/dev/spidev", 11) ){
+    return FAKE_FD;
+  }
+  va_start(ap, flags);
+  mode = va_arg(ap, int);
+  va_end(ap);
+  return __real_open(path, flags, mode);
+}
+
+/* register address to port and MCP23008 index, -1 if unimplemented */
+static int fake_map(fake_mcp_s *c, int regno, int *port)
+{
+  int idx;
+
+  if(c->bank){
+    *port = (regno >> 4) & 1;
+    idx = regno & 0x0f;
+  }
+  else{
+    *port = regno & 1;
+    idx = regno >> 1;
+  }
+  return (idx <= 10) ? idx : -1;
+}
+
+static void fake_write(fake_mcp_s *c, int regno, unsigned char v)
+{
+  int port, idx = fake_map(c, regno, &port);
+
+  if(idx == 5){
+    /* IOCON is one register seen from both ports */
+    c->reg[0][5] = c->reg[1][5] = v;
+    c->bank = (v >> 7) & 1;
+    c->haen = (v >> 3) & 1;
+  }
+  else if( (idx >= 0) && (idx != 7) && (idx != 8) ){
+    c->reg[port][idx] = v;
+  }
+}
+
+static unsigned char fake_read(fake_mcp_s *c, int regno)
+{
+  int port, idx = fake_map(c, regno, &port);
+
+  if( (idx == 8) || (idx == 9) ){
+    /* reading INTCAP or GPIO clears the interrupt */
+    c->irq[port] = 0;
+    return (idx == 8) ? c->reg[port][8] : (c->pins >> (port * 8)) & 0xff;
+  }
+  return (idx >= 0) ? c->reg[port][idx] : 0;
+}
+
+/* one transfer with chip select low: opcode, register, data */
+static void fake_xfer(unsigned char *tx, unsigned char *rx, int len)
+{
+  int a, i, k;
+
+  if( rx ){
+    memset(rx, 0, len);
+  }
+  if( (len < 2) || ((tx[0] & 0xf0) != 0x40) ){
+    return;
+  }
+  a = (tx[0] >> 1) & 7;
+  for(i=0; i<FAKE_CHIPS; i++){
+    /* without HAEN the address pins are ignored and the chip is 000 */
+    if( !chip[i].present || ((chip[i].haen ? i : 0) != a) ){
+      continue;
+    }
+    chip[i].xfers++;
+    for(k=2; k<len; k++){
+      if(tx[0] & 1){
+        if(rx){
+          rx[k] = fake_read(&chip[i], tx[1] + k - 2);
+        }
+      }
+      else{
+        fake_write(&chip[i], tx[1] + k - 2, tx[k]);
+      }
+    }
+  }
+}
+
+int __wrap_ioctl(int fd, unsigned long req, ...)
+{
+  va_list ap;
+  void *arg;
+  struct spi_ioc_transfer *tr;
+  int n, i, len = 0;
+
+  va_start(ap, req);
+  arg = va_arg(ap, void *);
+  va_end(ap);
+
+  if(fd != FAKE_FD){
+    return __real_ioctl(fd, req, arg);
+  }
+  if( (_IOC_TYPE(req) != SPI_IOC_MAGIC) || (_IOC_NR(req) != 0) ){
+    return 0;                     /* mode, word size and speed */
+  }
+  tr = arg;
+  n = _IOC_SIZE(req) / sizeof(struct spi_ioc_transfer);
+  for(i=0; i<n; i++){
+    fake_xfer((unsigned char *)(unsigned long)tr[i].tx_buf,
+              (unsigned char *)(unsigned long)tr[i].rx_buf, tr[i].len);
+    len += tr[i].len;
+  }
+  return len;
+}
+
+/* change the input levels, latching INTCAP like the chip does */
+static void fake_pins(int i, int pins)
+{
+  fake_mcp_s *c = &chip[i];
+  int port, old, new;
+
+  for(port=0; port<2; port++){
+    old = (c->pins >> (port * 8)) & 0xff;
+    new = (pins >> (port * 8)) & 0xff;
+    if( !c->irq[port] && ((old ^ new) & c->reg[port][2]) ){
+      c->reg[port][8] = new;
+      c->irq[port] = 1;
+    }
+  }
+  c->pins = pins;
+}
+
+/* the rest of the daemon, as far as iic.c needs it */
+
+static xio_dev_s xio[3];
+static int ev_val[16];
+static int ev_cnt = 0;
+
+int debug_on(void) { return 0; }
+int debug_lvl(void) { return 0; }
+int gpio_i2c_recover(int scl, int sda) { return 1; }
+void setup_xio(int n) { }
+xio_dev_s *get_xio(int n) { return &xio[n]; }
+
+void get_xio_parm(int n, iodev_e *type, int *bus, int *addr, int *regno)
+{
+  *type = xio[n].type;
+  *bus = xio[n].bus;
+  *addr = xio[n].addr;
+  *regno = xio[n].regno;
+}
+
+void handle_iic_event(int n, int value)
+{
+  if(ev_cnt < 16){
+    ev_val[ev_cnt++] = (n << 8) | value;
+  }
+}
+
+static void xio_add(int n, iodev_e type, int bus, int addr, int mask)
+{
+  xio[n].type = type;
+  xio[n].bus = bus;
+  xio[n].addr = addr;
+  xio[n].inmask = mask;
+  xio[n].regptr = -1;
+}
+
+int main(void)
+{
+  const xio_drv_s *drv;
+  int bus, i, value;
+
+  /* two chips sharing one chip select by their address pins */
+  chip[0].present = chip[3].present = 1;
+  chip[0].pins = chip[3].pins = 0xffff;
+
+  bus = iic_open_bus("/dev/spidev0.0");
+  CHECK_EQ(bus, 0);
+  CHECK(iic_is_spi(bus));
+
+  xio_add(0, IO_MCP23S17A, bus, 3, 0xff);
+  xio_add(1, IO_MCP23S17B, bus, 3, 0x0f);
+  xio_add(2, IO_MCP23S17A, bus, 0, 0xff);
+
+  /* the first init reaches both chips through address 0 and turns on
+   * HAEN, after that each one only answers to its own address */
+  for(i=0; i<3; i++){
+    drv = xio_driver(xio[i].type);
+    CHECK(drv && drv->spi);
+    CHECK(drv->init(&xio[i]) >= 0);
+  }
+  for(i=0; i<=3; i+=3){
+    CHECK(chip[i].bank && chip[i].haen);
+    CHECK_EQ(chip[i].reg[0][0], 0xff);   /* IODIR */
+    CHECK_EQ(chip[i].reg[0][6], 0xff);   /* GPPU */
+  }
+  CHECK_EQ(chip[3].reg[0][2], 0xff);     /* GPINTEN */
+  CHECK_EQ(chip[3].reg[1][2], 0x0f);
+  CHECK_EQ(chip[0].reg[1][2], 0x00);     /* port B of chip 0 is unused */
+
+  /* a press on chip 3 port A is captured and read in one burst */
+  chip[0].xfers = 0;
+  fake_pins(3, 0xfffb);
+  CHECK(chip[3].irq[0]);
+  poll_iic(0);
+  CHECK_EQ(ev_cnt, 1);
+  CHECK_EQ(ev_val[0], 0x00fb);
+  CHECK(!chip[3].irq[0]);
+  CHECK_EQ(chip[0].xfers, 0);
+
+  /* a tap already released when serviced still shows the press */
+  ev_cnt = 0;
+  fake_pins(3, 0xf7fb);
+  fake_pins(3, 0xfffb);
+  poll_iic(1);
+  CHECK_EQ(ev_cnt, 2);
+  CHECK_EQ(ev_val[0], 0x01f7);
+  CHECK_EQ(ev_val[1], 0x01ff);
+
+  /* the plain read used when polling sees only the addressed chip */
+  fake_pins(0, 0xff7e);
+  drv = xio_driver(IO_MCP23S17A);
+  CHECK(drv->read(&xio[2], &value) == 0);
+  CHECK_EQ(value, 0x7e);
+  CHECK(drv->read(&xio[0], &value) == 0);
+  CHECK_EQ(value, 0xfb);
+
+  return TEST_DONE("xio_spi");
+}
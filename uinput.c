@@ -30,135 +30,1005 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <time.h>
+#include <pthread.h>
 #include <linux/input.h>
 #include <linux/uinput.h>
 #include "config.h"
+#include "gpio.h"
 #include "uinput.h"
+#include "macro.h"
+#include "uring.h"
+#include "stream.h"
 #include "debug.h"
 
-int sendRel(int dx, int dy);
-int sendSync(void);
+/* frames on their way to the writer, one producer and the writer */
+typedef struct {
+  struct input_event ev[UINPUT_RING];
+  volatile unsigned head;               /* advanced by the producer */
+  volatile unsigned tail;               /* advanced by the writer */
+} uinput_queue_s;
+
+/* one virtual device per class of input, created when something uses it */
+typedef struct {
+  const char *cls;                      /* DEVICE configuration name */
+  char name[UINPUT_MAX_NAME_SIZE];
+  int vendor, product;
+  int fd;
+  int keys;                             /* key codes advertised */
+  unsigned long key_bits[KEY_CNT / (8 * sizeof(long)) + 1];
+  int rel_bits;
+  unsigned long long abs_bits;
+
+  /* events of one main loop pass, written out together by uinput_flush() */
+  struct input_event out_buf[UINPUT_BUF];
+  int out_n;                            /* events in out_buf */
+  int out_frame;                        /* where the open frame starts */
+  int frame_msc;                        /* MSC_TIMESTAMP of the open frame, -1 */
+
+  /* queue 0 is filled by uinput_flush(), 1 by uinput_post() */
+  uinput_queue_s q[UINPUT_QUEUES];
+} uinput_dev_s;
+
+static uinput_dev_s uidev[UINPUT_DEVS] = {
+  { "KEYBOARD", "pikeyd", 0x1, 0x1, -1 },
+  { "GAMEPAD", "pikeyd gamepad", 0x1, 0x2, -1 },
+  { "MOUSE", "pikeyd mouse", 0x1, 0x3, -1 },
+};
 
-static struct input_event     uidev_ev;
-static int uidev_fd;
 static keyinfo_s lastkey;
+static struct { int min, max, fuzz, flat; } abs_info[ABS_CNT];
+static int hold_mode = 0;
+static int rep_delay = 0, rep_period = 0;
+static unsigned long long stamp = 0;    /* sample time of the events being sent */
+
+static pthread_t writer_thread;
+static pthread_mutex_t writer_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t writer_cond = PTHREAD_COND_INITIALIZER;
+static volatile int writer_stop = 0;
+
+/* main loop counters */
+static unsigned long st_events = 0;
+static unsigned long st_frames = 0;
+static unsigned long st_full = 0;       /* events dropped, ring full */
+static unsigned st_hwm = 0;             /* ring high water mark */
+static time_t st_time = 0;
+
+/* writer counters, only ever counted up */
+static volatile unsigned long wr_writes = 0;
+static volatile unsigned long wr_drops = 0;
+static unsigned long wr_writes_seen = 0;
+static unsigned long wr_drops_seen = 0;
+
+/* uinput_post() counters, from the posting thread */
+static volatile unsigned long pt_events = 0;
+static volatile unsigned long pt_frames = 0;
+static volatile unsigned long pt_full = 0;
+static volatile unsigned pt_hwm = 0;    /* queue high water mark */
+static unsigned long pt_events_seen = 0;
+static unsigned long pt_frames_seen = 0;
+static unsigned long pt_full_seen = 0;
 
-#define die(str, args...) do { \
+/* sample to write delay of the stamped frames, counted by whoever writes;
+ * bucket 0 is under 1ms, bucket i from 2^(i-1) to 2^i ms */
+static volatile unsigned long lat_hist[UINPUT_LAT_BUCKETS];
+static volatile unsigned long long lat_sum = 0;
+static unsigned long lat_hist_seen[UINPUT_LAT_BUCKETS];
+static unsigned long long lat_sum_seen = 0;
+
+/* the same for single keys, taken from the frame each one was written in */
+typedef struct{
+  int code;
+  volatile unsigned long n;
+  volatile unsigned long long sum;
+  volatile unsigned max;
+} lat_key_s;
+
+static lat_key_s lat_key[UINPUT_LAT_KEYS];
+static int lat_keys = 0;
+
+#ifdef USE_URING
+/* with io_uring the main loop does the writing, no writer thread */
+static int uring_ok = 0;
+static int timer_busy = 0;
+/* per queue, device d queue i is d * UINPUT_QUEUES + i */
+static unsigned wr_len[UINPUT_DEVS * UINPUT_QUEUES];  /* in flight, 0 for none */
+static int wr_tries[UINPUT_DEVS * UINPUT_QUEUES];
+#endif
+
+static void out_event(int type, int code, int value);
+static void out_sync(uinput_dev_s *dev);
+
+#define KEY_USED(d, k) (((d)->key_bits[(k) / (8*sizeof(long))] >> ((k) % (8*sizeof(long)))) & 1)
+
+/* create_dev() gives up: the device is closed and left out */
+#define dev_fail(str) do { \
         perror(str); \
-        return(EXIT_FAILURE); \
+        goto fail; \
     } while(0)
 
-int init_uinput(void) {
+
+/* the device an event belongs to: pointer buttons and motion to the
+ * mouse, game controller buttons and axes to the gamepad, the rest
+ * are keyboard keys */
+static uinput_dev_s *event_dev(int type, int code)
+{
+  if (type == EV_REL) {
+    return(&uidev[UINPUT_MOUSE]);
+  }
+  if (type == EV_ABS) {
+    return(&uidev[UINPUT_PAD]);
+  }
+  if ((code >= BTN_MOUSE) && (code < BTN_JOYSTICK)) {
+    return(&uidev[UINPUT_MOUSE]);
+  }
+  if (((code >= BTN_JOYSTICK) && (code < BTN_DIGI)) ||
+      ((code >= BTN_DPAD_UP) && (code <= BTN_DPAD_RIGHT)) ||
+      (code >= BTN_TRIGGER_HAPPY)) {
+    return(&uidev[UINPUT_PAD]);
+  }
+  return(&uidev[UINPUT_KBD]);
+}
+
+
+static int create_dev(uinput_dev_s *dev) {
 
   int fd;
-  struct uinput_user_dev uidev;
+  struct uinput_setup usetup;
+  struct uinput_abs_setup abs_setup;
+  struct uinput_user_dev udev;
   int i;
 
   fd = open("/dev/uinput", O_WRONLY | O_NONBLOCK);
-  if(fd < 0)
-    die("/dev/uinput");
+  if(fd < 0){
+    perror("/dev/uinput");
+    dev->fd = -1;
+    return(-1);
+  }
 
-  if(ioctl(fd, UI_SET_EVBIT, EV_KEY) < 0)
-    die("error: ioctl");
-  if(ioctl(fd, UI_SET_EVBIT, EV_REP) < 0)
-    die("error: ioctl");
-  if(ioctl(fd, UI_SET_KEYBIT, BTN_LEFT) < 0)
-    die("error: ioctl");
+  /* only the codes the configuration uses, so the device is classified
+     for what it really is */
+  for(i=0; i<KEY_CNT; i++){
+    if(KEY_USED(dev, i)){
+      if(!dev->keys++ && (ioctl(fd, UI_SET_EVBIT, EV_KEY) < 0))
+        dev_fail("error: ioctl");
+      if(ioctl(fd, UI_SET_KEYBIT, i) < 0)
+        dev_fail("error: ioctl");
+    }
+  }
+
+  /* held keyboard keys are repeated by the input core, unless repeat is off */
+  if ((dev == &uidev[UINPUT_KBD]) && dev->keys && (!hold_mode || rep_period)) {
+    if(ioctl(fd, UI_SET_EVBIT, EV_REP) < 0)
+      dev_fail("error: ioctl");
+  }
+
+  /* the sample time of each frame */
+  if((ioctl(fd, UI_SET_EVBIT, EV_MSC) < 0) || (ioctl(fd, UI_SET_MSCBIT, MSC_TIMESTAMP) < 0))
+    dev_fail("error: ioctl");
 
-  /* don't forget to add all the keys! */
-  for(i=0; i<256; i++){
-    if(ioctl(fd, UI_SET_KEYBIT, i) < 0)
-      die("error: ioctl");
+  if (dev->rel_bits) {
+    if(ioctl(fd, UI_SET_EVBIT, EV_REL) < 0)
+      dev_fail("error: ioctl");
+    for(i=0; i<REL_CNT; i++){
+      if((dev->rel_bits & (1<<i)) && (ioctl(fd, UI_SET_RELBIT, i) < 0))
+        dev_fail("error: ioctl");
+    }
+  }
+
+  if (dev->abs_bits) {
+    if(ioctl(fd, UI_SET_EVBIT, EV_ABS) < 0)
+      dev_fail("error: ioctl");
+    for(i=0; i<ABS_CNT; i++){
+      if((dev->abs_bits & (1ULL<<i)) && (ioctl(fd, UI_SET_ABSBIT, i) < 0))
+        dev_fail("error: ioctl");
+    }
   }
 
-  memset(&uidev, 0, sizeof(uidev));
-  snprintf(uidev.name, UINPUT_MAX_NAME_SIZE, "pikeyd");
-  uidev.id.bustype = BUS_USB;
-  uidev.id.vendor  = 0x1;
-  uidev.id.product = 0x1;
-  uidev.id.version = 1;
+  memset(&usetup, 0, sizeof(usetup));
+  snprintf(usetup.name, UINPUT_MAX_NAME_SIZE, "%s", dev->name);
+  usetup.id.bustype = BUS_USB;
+  usetup.id.vendor  = dev->vendor;
+  usetup.id.product = dev->product;
+  usetup.id.version = 1;
 
-  if(write(fd, &uidev, sizeof(uidev)) < 0)
-    die("error: write");
+  if(ioctl(fd, UI_DEV_SETUP, &usetup) == 0){
+    for(i=0; i<ABS_CNT; i++){
+      if(dev->abs_bits & (1ULL<<i)){
+        memset(&abs_setup, 0, sizeof(abs_setup));
+        abs_setup.code = i;
+        abs_setup.absinfo.minimum = abs_info[i].min;
+        abs_setup.absinfo.maximum = abs_info[i].max;
+        abs_setup.absinfo.fuzz = abs_info[i].fuzz;
+        abs_setup.absinfo.flat = abs_info[i].flat;
+        if(ioctl(fd, UI_ABS_SETUP, &abs_setup) < 0)
+          dev_fail("error: ioctl");
+      }
+    }
+  }
+  else {
+    /* kernels before 4.5 only take the uinput_user_dev write */
+    memset(&udev, 0, sizeof(udev));
+    memcpy(udev.name, usetup.name, UINPUT_MAX_NAME_SIZE);
+    udev.id = usetup.id;
+    for(i=0; i<ABS_CNT; i++){
+      if(dev->abs_bits & (1ULL<<i)){
+        udev.absmin[i] = abs_info[i].min;
+        udev.absmax[i] = abs_info[i].max;
+        udev.absfuzz[i] = abs_info[i].fuzz;
+        udev.absflat[i] = abs_info[i].flat;
+      }
+    }
+    if(write(fd, &udev, sizeof(udev)) < 0)
+      dev_fail("error: write");
+  }
 
   if(ioctl(fd, UI_DEV_CREATE) < 0)
-    die("error: ioctl");
+    dev_fail("error: ioctl");
+
+  dev->fd = fd;
+  dev->frame_msc = -1;
+
+  return(0);
+
+fail:
+  close(fd);
+  dev->fd = -1;
+  return(-1);
+}
+
+
+/* anything configured to go through the device */
+static int dev_used(uinput_dev_s *dev) {
+
+  int i;
+
+  if (dev->rel_bits || dev->abs_bits) {
+    return(1);
+  }
+  for (i=0; i<KEY_CNT; i++) {
+    if (KEY_USED(dev, i)) {
+      return(1);
+    }
+  }
+  return(0);
+}
+
 
-  uidev_fd = fd;
+/* time from the sample to now for every stamped frame just written, and
+ * for the watched keys in those frames */
+static void lat_count(struct input_event *ev, int n)
+{
+  unsigned now, lat = 0;
+  int i, j, b, stamped = 0;
+
+  now = (unsigned) gpio_time_us();
+  for (i=0; i<n; i++) {
+    if ((ev[i].type == EV_MSC) && (ev[i].code == MSC_TIMESTAMP)) {
+      lat = now - (unsigned) ev[i].value;
+      for (b=0; (b < UINPUT_LAT_BUCKETS-1) && (lat >= (1000U << b)); b++);
+      lat_hist[b]++;
+      lat_sum += lat;
+      stamped = 1;
+    }
+    else if (ev[i].type == EV_SYN) {
+      stamped = 0;
+    }
+    else if (stamped && (ev[i].type == EV_KEY)) {
+      for (j=0; j<lat_keys; j++) {
+        if (lat_key[j].code == ev[i].code) {
+          lat_key[j].n++;
+          lat_key[j].sum += lat;
+          if (lat > lat_key[j].max) {
+            lat_key[j].max = lat;
+          }
+          break;
+        }
+      }
+    }
+  }
+}
+
+
+static int writer_pending(void)
+{
+  int d, i;
+
+  for (d=0; d<UINPUT_DEVS; d++) {
+    for (i=0; i<UINPUT_QUEUES; i++) {
+      if (uidev[d].q[i].head != uidev[d].q[i].tail) {
+        return(1);
+      }
+    }
+  }
+  return(0);
+}
+
+
+/* write out one queue of a device */
+static void writer_drain(uinput_dev_s *dev, uinput_queue_s *q)
+{
+  unsigned head, tail, n;
+  int tries;
+
+  head = q->head;
+  __sync_synchronize();
+  tail = q->tail;
+  while (tail != head) {
+    /* up to the end of the ring, the rest on the next pass */
+    n = head - tail;
+    if ((tail % UINPUT_RING) + n > UINPUT_RING) {
+      n = UINPUT_RING - (tail % UINPUT_RING);
+    }
+    for (tries=0; ; tries++) {
+      if (write(dev->fd, &q->ev[tail % UINPUT_RING],
+                n * sizeof(struct input_event)) >= 0) {
+        wr_writes++;
+        lat_count(&q->ev[tail % UINPUT_RING], n);
+        break;
+      }
+      if ((errno != EAGAIN) || (tries >= UINPUT_RETRY)) {
+        if (errno != EAGAIN) {
+          perror("error: uinput write");
+        }
+        wr_drops += n;
+        break;
+      }
+      usleep(UINPUT_RETRY_US);
+    }
+    tail += n;
+    __sync_synchronize();
+    q->tail = tail;
+  }
+}
+
+
+/* Writes the frames the main loop and uinput_post() queued.  A device that
+ * can't keep up (EAGAIN) is retried a few times, then the events are
+ * dropped and counted, the scan never waits for the readers.
+ */
+static void *uinput_writer(void *arg)
+{
+  int d, i;
+
+  while (!writer_stop) {
+    pthread_mutex_lock(&writer_lock);
+    while (!writer_pending() && !writer_stop) {
+      pthread_cond_wait(&writer_cond, &writer_lock);
+    }
+    pthread_mutex_unlock(&writer_lock);
+
+    for (d=0; d<UINPUT_DEVS; d++) {
+      for (i=0; i<UINPUT_QUEUES; i++) {
+        writer_drain(&uidev[d], &uidev[d].q[i]);
+      }
+    }
+  }
+
+  return(NULL);
+}
+
+
+/* remove the devices that were created, non zero if one wouldn't go */
+static int destroy_devs(void)
+{
+  int d, err = 0;
+
+  for (d=0; d<UINPUT_DEVS; d++) {
+    if (uidev[d].fd < 0) {
+      continue;
+    }
+    if (ioctl(uidev[d].fd, UI_DEV_DESTROY) < 0) {
+      perror("error: ioctl");
+      err = 1;
+    }
+    close(uidev[d].fd);
+    uidev[d].fd = -1;
+  }
+  return(err);
+}
+
+
+/* create the devices and start the writer, 0 on failure */
+int init_uinput(void) {
+
+  int d;
+
+  /* devices nothing is configured for are left out */
+  for (d=0; d<UINPUT_DEVS; d++) {
+    if (dev_used(&uidev[d]) && (create_dev(&uidev[d]) < 0)) {
+      destroy_devs();
+      return(0);
+    }
+    if ((debug_lvl() >= DEBUG_DEV1) && (uidev[d].fd >= 0)) {
+      printf("uinput: %s device \"%s\" %04x:%04x\n", uidev[d].cls,
+             uidev[d].name, uidev[d].vendor, uidev[d].product);
+    }
+  }
+
+#ifdef USE_URING
+  if (uring_init(URING_ENTRIES) == 0) {
+    uring_ok = 1;
+  }
+  else {
+    perror("io_uring, using a writer thread");
+  }
+  if (!uring_ok)
+#endif
+  if (pthread_create(&writer_thread, NULL, uinput_writer, NULL)) {
+    perror("uinput writer");
+    destroy_devs();
+    return(0);
+  }
+
+  /* an EV_REP event written to uinput sets the device's repeat timing */
+  if (hold_mode && rep_period && (uidev[UINPUT_KBD].fd >= 0)) {
+    out_event(EV_REP, REP_DELAY, rep_delay);
+    out_event(EV_REP, REP_PERIOD, rep_period);
+    uinput_flush();
+  }
 
   return(1);
 }
 
 
+/* name and IDs (-1 leaves the default) of a device, before init_uinput() */
+int uinput_device(const char *cls, const char *name, int vendor, int product)
+{
+  int d;
+
+  for (d=0; d<UINPUT_DEVS; d++) {
+    if (!strcmp(cls, uidev[d].cls)) {
+      snprintf(uidev[d].name, UINPUT_MAX_NAME_SIZE, "%s", name);
+      if (vendor >= 0) {
+        uidev[d].vendor = vendor;
+        uidev[d].product = product;
+      }
+      return(d);
+    }
+  }
+  return(-1);
+}
+
+
+/* report keys as held down until released and leave repeating to the
+ * kernel, "period" 0 turns repeat off. Must be before init_uinput() */
+void uinput_hold(int delay, int period)
+{
+  hold_mode = 1;
+  rep_delay = delay;
+  rep_period = period;
+}
+
+
+int uinput_holding(void)
+{
+  return(hold_mode);
+}
+
+
+/* configuration asks for a relative axis, must be before init_uinput() */
+void uinput_use_rel(int code)
+{
+  if ((code >= 0) && (code < REL_CNT)) {
+    event_dev(EV_REL, code)->rel_bits |= 1 << code;
+  }
+
+  /* a pointer without a button isn't taken for a mouse */
+  if ((code == REL_X) || (code == REL_Y)) {
+    uinput_use_key(BTN_LEFT);
+  }
+}
+
+
+/* configuration sends a key or button, must be before init_uinput() */
+void uinput_use_key(int code)
+{
+  uinput_dev_s *dev;
+
+  if ((code > 0) && (code < KEY_CNT)) {
+    dev = event_dev(EV_KEY, code);
+    dev->key_bits[code / (8*sizeof(long))] |= 1UL << (code % (8*sizeof(long)));
+  }
+}
+
+
+/* configuration asks for an absolute axis, must be before init_uinput() */
+void uinput_use_abs(int code, int min, int max, int fuzz, int flat)
+{
+  if ((code >= 0) && (code < ABS_CNT)) {
+    event_dev(EV_ABS, code)->abs_bits |= 1ULL << code;
+    abs_info[code].min = min;
+    abs_info[code].max = max;
+    abs_info[code].fuzz = fuzz;
+    abs_info[code].flat = flat;
+  }
+}
+
+
 int close_uinput(void)
 {
-  sleep(2);
+  int d;
 
-  if(ioctl(uidev_fd, UI_DEV_DESTROY) < 0)
-    die("error: ioctl");
+  /* let the writer empty the rings before it goes */
+  uinput_flush();
+  for (d=0; (d < 100) && writer_pending(); d++) {
+    uinput_sleep(1000);
+  }
+#ifdef USE_URING
+  if (!uring_ok)
+#endif
+  {
+    pthread_mutex_lock(&writer_lock);
+    writer_stop = 1;
+    pthread_cond_signal(&writer_cond);
+    pthread_mutex_unlock(&writer_lock);
+    pthread_join(writer_thread, NULL);
+  }
 
-  close(uidev_fd);
+  return(destroy_devs() ? 0 : 1);
+}
 
-  return(1);
+
+/* queue an event on its device, it goes out with the next uinput_flush() */
+static void out_event(int type, int code, int value)
+{
+  uinput_dev_s *dev = event_dev(type, code);
+  int i;
+
+  /* nothing was configured for that device */
+  if (dev->fd < 0) {
+    return;
+  }
+
+  /* room for this event, a timestamp and the SYN closing its frame */
+  if (dev->out_n + 3 > UINPUT_BUF) {
+    uinput_flush();
+  }
+
+  /* a second change to the same code in one frame would hide the first
+     (a press and release together is no key at all), so it starts a new one */
+  for (i=dev->out_frame; i<dev->out_n; i++) {
+    if ((dev->out_buf[i].type == type) && (dev->out_buf[i].code == code)) {
+      out_sync(dev);
+      break;
+    }
+  }
+
+  /* a frame is stamped with the earliest sample time of its events,
+     MSC_TIMESTAMP is in microseconds and wraps */
+  if (stamp && (type != EV_REP)) {
+    if (dev->frame_msc < 0) {
+      dev->frame_msc = dev->out_n;
+      memset(&dev->out_buf[dev->out_n], 0, sizeof(struct input_event));
+      dev->out_buf[dev->out_n].type = EV_MSC;
+      dev->out_buf[dev->out_n].code = MSC_TIMESTAMP;
+      dev->out_buf[dev->out_n].value = (int) stamp;
+      dev->out_n++;
+    }
+    else if ((int) ((unsigned) stamp - (unsigned) dev->out_buf[dev->frame_msc].value) < 0) {
+      dev->out_buf[dev->frame_msc].value = (int) stamp;
+    }
+  }
+
+  memset(&dev->out_buf[dev->out_n], 0, sizeof(struct input_event));
+  dev->out_buf[dev->out_n].type = type;
+  dev->out_buf[dev->out_n].code = code;
+  dev->out_buf[dev->out_n].value = value;
+  dev->out_n++;
 }
 
 
-int sendKey(int key, int value)
+/* CLOCK_MONOTONIC time (gpio_time_us()) the next events were sampled at,
+ * 0 when they weren't caused by a sample. Set by every source before it
+ * sends */
+void uinput_stamp(unsigned long long t)
 {
-  memset(&uidev_ev, 0, sizeof(struct input_event));
-  gettimeofday(&uidev_ev.time, NULL);
-  uidev_ev.type = EV_KEY;
-  uidev_ev.code = key;
-  uidev_ev.value = value;
+  stamp = t;
+}
+
 
+/* keep the sample to write delay of "code" on its own, set up before
+ * init_uinput() */
+int uinput_lat_key(int code)
+{
+  int j;
+
+  for (j=0; j<lat_keys; j++) {
+    if (lat_key[j].code == code) {
+      return(0);
+    }
+  }
+  if (lat_keys >= UINPUT_LAT_KEYS) {
+    return(-1);
+  }
+  lat_key[lat_keys++].code = code;
+  return(0);
+}
+
+
+/* writes of "code" and their total delay so far, and the longest delay
+ * since the last call; -1 if the key isn't watched */
+int uinput_key_latency(int code, unsigned long *n, unsigned long long *sum, unsigned *max)
+{
+  int j;
+
+  for (j=0; j<lat_keys; j++) {
+    if (lat_key[j].code == code) {
+      *n = lat_key[j].n;
+      *sum = lat_key[j].sum;
+      *max = __sync_lock_test_and_set(&lat_key[j].max, 0);
+      return(0);
+    }
+  }
+  return(-1);
+}
+
+
+int sendKey(int key, int value)
+{
   if (debug_lvl() >= DEBUG_DEV4) {
     printf("sendKey: %d = %d\n", key, value);
   }
 
-  if(write(uidev_fd, &uidev_ev, sizeof(struct input_event)) < 0)
-    die("error: write");
-
-  sendSync();
+  out_event(EV_KEY, key, value);
 
   return 0;
 }
 
 
-int sendRel(int dx, int dy)
+int sendRelAxis(int code, int value)
 {
-  memset(&uidev_ev, 0, sizeof(struct input_event));
-  uidev_ev.type = EV_REL;
-  uidev_ev.code = REL_X;
-  uidev_ev.value = dx;
-  if(write(uidev_fd, &uidev_ev, sizeof(struct input_event)) < 0)
-    die("error: write");
+  if (debug_lvl() >= DEBUG_DEV4) {
+    printf("sendRel: %d = %d\n", code, value);
+  }
 
-  memset(&uidev_ev, 0, sizeof(struct input_event));
-  uidev_ev.type = EV_REL;
-  uidev_ev.code = REL_Y;
-  uidev_ev.value = dy;
-  if(write(uidev_fd, &uidev_ev, sizeof(struct input_event)) < 0)
-    die("error: write");
+  out_event(EV_REL, code, value);
 
-  sendSync();
+  return 0;
+}
+
+
+int sendAbs(int code, int value)
+{
+  if (debug_lvl() >= DEBUG_DEV4) {
+    printf("sendAbs: %d = %d\n", code, value);
+  }
+
+  out_event(EV_ABS, code, value);
 
   return 0;
 }
 
 
+/* Queue "n" events sampled at "t" as one frame from a thread other than
+ * the main loop (the mouse), without waiting for the next pass.  They go
+ * to the writer through their device's own queue, stamped like everything
+ * else, and share its retries and drop counts.  All events must belong to
+ * the device of the first one and only one thread may post.  With the
+ * io_uring backend they are written on the main loop's next tick.
+ */
+int uinput_post(struct input_event *ev, int n, unsigned long long t)
+{
+  uinput_dev_s *dev;
+  uinput_queue_s *q;
+  struct input_event frame[UINPUT_FRAME + 2];
+  struct timeval tv;
+  unsigned head, fill;
+  int i, m = 0;
+
+  if ((n < 1) || (n > UINPUT_FRAME)) {
+    return(-1);
+  }
+  dev = event_dev(ev[0].type, ev[0].code);
+  q = &dev->q[1];
+  if (dev->fd < 0) {
+    return(-1);
+  }
+
+  gettimeofday(&tv, NULL);
+  memset(frame, 0, (n + 2) * sizeof(struct input_event));
+  if (t) {
+    frame[m].type = EV_MSC;
+    frame[m].code = MSC_TIMESTAMP;
+    frame[m++].value = (int) t;
+  }
+  for (i=0; i<n; i++) {
+    frame[m++] = ev[i];
+  }
+  frame[m].type = EV_SYN;
+  frame[m++].code = SYN_REPORT;
+
+  if (debug_lvl() >= DEBUG_DEV4) {
+    printf("uinput_post: %d events\n", n);
+  }
+
+  head = q->head;
+  fill = head - q->tail;
+  if (fill + m > UINPUT_RING) {
+    pt_full += m;
+    return(-1);
+  }
+  for (i=0; i<m; i++) {
+    frame[i].time = tv;
+    q->ev[(head + i) % UINPUT_RING] = frame[i];
+  }
+  __sync_synchronize();
+  q->head = head + m;
+  pt_events += m;
+  pt_frames++;
+  if (fill + m > pt_hwm) {
+    pt_hwm = fill + m;
+  }
+
+#ifdef USE_URING
+  if (uring_ok) {
+    return(0);                          /* written by uinput_sleep() */
+  }
+#endif
+  pthread_mutex_lock(&writer_lock);
+  pthread_cond_signal(&writer_cond);
+  pthread_mutex_unlock(&writer_lock);
+
+  return(0);
+}
+
+
+/* close a device's open frame with a SYN_REPORT, readers wake once per frame */
+static void out_sync(uinput_dev_s *dev)
+{
+  if (dev->out_n > dev->out_frame) {
+    memset(&dev->out_buf[dev->out_n], 0, sizeof(struct input_event));
+    dev->out_buf[dev->out_n].type = EV_SYN;
+    dev->out_buf[dev->out_n].code = SYN_REPORT;
+    dev->out_buf[dev->out_n].value = 0;
+    dev->out_n++;
+    dev->out_frame = dev->out_n;
+    dev->frame_msc = -1;
+    st_frames++;
+  }
+}
+
+
 int sendSync(void)
 {
-  memset(&uidev_ev, 0, sizeof(struct input_event));
-  uidev_ev.type = EV_SYN;
-  uidev_ev.code = SYN_REPORT;
-  uidev_ev.value = 0;
-  if(write(uidev_fd, &uidev_ev, sizeof(struct input_event)) < 0)
-    die("error: sendSync - write");
+  int d;
+
+  for (d=0; d<UINPUT_DEVS; d++) {
+    out_sync(&uidev[d]);
+  }
 
   return 0;
 }
 
 
+/* hand everything queued since the last flush to the writer thread,
+ * called once per main loop */
+int uinput_flush(void)
+{
+  uinput_dev_s *dev;
+  uinput_queue_s *q;
+  struct timeval tv;
+  time_t now;
+  unsigned head, fill;
+  int d, i, queued = 0;
+  unsigned long w, dr, pe, pf, pd, h, lat_n, lat_top;
+  unsigned long long ls;
+
+  gettimeofday(&tv, NULL);
+  for (d=0; d<UINPUT_DEVS; d++) {
+    dev = &uidev[d];
+    out_sync(dev);
+    if (!dev->out_n) {
+      continue;
+    }
+    st_events += dev->out_n;
+
+    /* whole passes go in or are dropped, never part of a frame */
+    q = &dev->q[0];
+    head = q->head;
+    fill = head - q->tail;
+    if (fill + dev->out_n > UINPUT_RING) {
+      st_full += dev->out_n;
+    }
+    else {
+      for (i=0; i<dev->out_n; i++) {
+        dev->out_buf[i].time = tv;
+        q->ev[(head + i) % UINPUT_RING] = dev->out_buf[i];
+      }
+      __sync_synchronize();
+      q->head = head + dev->out_n;
+      fill += dev->out_n;
+      if (fill > st_hwm) {
+        st_hwm = fill;
+      }
+      queued = 1;
+    }
+    dev->out_n = dev->out_frame = 0;
+  }
+  stamp = 0;
+
+  /* the input record stream goes out with the same pass */
+  stream_flush();
+
+#ifdef USE_URING
+  if (uring_ok) {
+    queued = 0;                         /* written by uinput_sleep() */
+  }
+#endif
+  if (queued) {
+    pthread_mutex_lock(&writer_lock);
+    pthread_cond_signal(&writer_cond);
+    pthread_mutex_unlock(&writer_lock);
+  }
+
+  if (debug_on()) {
+    now = time(NULL);
+    w = wr_writes;
+    dr = wr_drops;
+    pe = pt_events;
+    pf = pt_frames;
+    pd = pt_full;
+    if (pt_hwm > st_hwm) {
+      st_hwm = pt_hwm;
+    }
+    if (!st_time) {
+      st_time = now;
+    }
+    else if ((now - st_time >= UINPUT_REPORT) && (st_events || (pe != pt_events_seen))) {
+      printf("uinput: %lu events in %lu frames, %lu writes, ring high water %u/%d, dropped %lu full %lu busy\n",
+             st_events + pe - pt_events_seen, st_frames + pf - pt_frames_seen,
+             w - wr_writes_seen, st_hwm, UINPUT_RING,
+             st_full + pd - pt_full_seen, dr - wr_drops_seen);
+      st_events = st_frames = st_full = 0;
+      st_hwm = pt_hwm = 0;
+      wr_writes_seen = w;
+      wr_drops_seen = dr;
+      pt_events_seen = pe;
+      pt_frames_seen = pf;
+      pt_full_seen = pd;
+      st_time = now;
+
+      /* sample to write delay */
+      lat_n = lat_top = 0;
+      for (i=0; i<UINPUT_LAT_BUCKETS; i++) {
+        h = lat_hist[i];
+        if (h != lat_hist_seen[i]) {
+          lat_n += h - lat_hist_seen[i];
+          lat_top = i;
+          lat_hist_seen[i] = h;
+        }
+      }
+      ls = lat_sum;
+      if (lat_n) {
+        printf("uinput: sample to write avg %lluus, worst %s%dms, %lu frames\n",
+               (ls - lat_sum_seen) / lat_n,
+               (lat_top == UINPUT_LAT_BUCKETS-1) ? ">" : "<",
+               (lat_top == UINPUT_LAT_BUCKETS-1) ? 1 << (lat_top-1) : 1 << lat_top,
+               lat_n);
+      }
+      lat_sum_seen = ls;
+    }
+  }
+
+  return 0;
+}
+
+
+#ifdef USE_URING
+/* a write or the tick timer finished */
+static void uinput_done(unsigned long long data, int res)
+{
+  uinput_queue_s *q;
+
+  if (data >= UINPUT_DEVS * UINPUT_QUEUES) {
+    timer_busy = 0;
+    return;
+  }
+  q = &uidev[data / UINPUT_QUEUES].q[data % UINPUT_QUEUES];
+
+  /* refused, tried again on the next tick */
+  if ((res == -EAGAIN) && (++wr_tries[data] <= UINPUT_RETRY)) {
+    wr_len[data] = 0;
+    return;
+  }
+  if (res < 0) {
+    if (res != -EAGAIN) {
+      fprintf(stderr, "error: uinput write: %s\n", strerror(-res));
+    }
+    wr_drops += wr_len[data];
+  }
+  else {
+    wr_writes++;
+    lat_count(&q->ev[q->tail % UINPUT_RING], wr_len[data]);
+  }
+  q->tail += wr_len[data];
+  wr_len[data] = 0;
+  wr_tries[data] = 0;
+}
+#endif
+
+
+/* Wait out the rest of a main loop tick.  With io_uring the frames
+ * uinput_flush() queued are written by the same io_uring_enter() that
+ * waits for the tick timer, one system call per tick.
+ */
+void uinput_sleep(int us)
+{
+#ifdef USE_URING
+  uinput_queue_s *q;
+  unsigned head, tail, n;
+  int r, wait = 0;
+
+  if (uring_ok) {
+    for (r=0; r<UINPUT_DEVS * UINPUT_QUEUES; r++) {
+      q = &uidev[r / UINPUT_QUEUES].q[r % UINPUT_QUEUES];
+      head = q->head;
+      __sync_synchronize();
+      tail = q->tail;
+      if (wr_len[r] || (head == tail)) {
+        continue;
+      }
+      n = head - tail;
+      if ((tail % UINPUT_RING) + n > UINPUT_RING) {
+        n = UINPUT_RING - (tail % UINPUT_RING);
+      }
+      if (uring_write(uidev[r / UINPUT_QUEUES].fd, &q->ev[tail % UINPUT_RING],
+                      n * sizeof(struct input_event), r) == 0) {
+        wr_len[r] = n;
+        wait++;
+      }
+    }
+    if (!timer_busy && (uring_timeout(us, UINPUT_DEVS * UINPUT_QUEUES) == 0)) {
+      timer_busy = 1;
+      wait++;
+    }
+
+    /* every write completes at once, the timer after "us" */
+    while (timer_busy) {
+      if ((uring_enter(wait) < 0) && (errno != EINTR)) {
+        perror("io_uring_enter");
+        usleep(us);
+        break;
+      }
+      uring_reap(uinput_done);
+      wait = 1;
+    }
+    return;
+  }
+#endif
+  usleep(us);
+}
+
+
+/* keys of a pin going down (value 1) or up (value 0) in hold mode */
+int send_gpio_state(int grp, int gpio, int value) {
+
+  int k = -1;
+  int xio;
+
+  restart_keys(grp);
+  while( got_more_keys(grp, gpio) ){
+    k = get_next_key(grp, gpio);
+    if(is_xio(gpio)){
+      if (value) {
+        xio = get_curr_xio_no();
+        poll_iic(xio);
+      }
+    }
+    else if(macro_is_key(k)){
+      if (value) {
+        macro_play(k);
+      }
+    }
+    else if(k<0x300){
+      sendKey(k, value);
+    }
+  }
+  return k;
+}
+
+
 int send_gpio_keys(int grp, int gpio) {
 
   int k;
@@ -171,6 +1041,9 @@ int send_gpio_keys(int grp, int gpio) {
       xio = get_curr_xio_no();
       poll_iic(xio);
     }
+    else if(macro_is_key(k)){
+      macro_play(k);
+    }
     else if(k<0x300){
       sendKey(k, 1);
       sendKey(k, 0);
@@ -26,9 +26,43 @@
 #ifndef _UINPUT_H_
 #define _UINPUT_H_
 
+#include <linux/input.h>
+
+#define UINPUT_FRAME    64      /* most events in one uinput_post() */
+#define UINPUT_BUF      512     /* events queued between uinput_flush() calls */
+#define UINPUT_REPORT   10      /* seconds between -D write counts */
+#define UINPUT_RING     1024    /* events queued for the writer, power of 2 */
+#define UINPUT_QUEUES   2       /* per device: main loop and uinput_post() */
+#define UINPUT_RETRY    3       /* retries of a write the device refused */
+#define UINPUT_RETRY_US 1000
+#define UINPUT_LAT_BUCKETS 8    /* sample to write delay, <1ms to >64ms */
+#define UINPUT_LAT_KEYS 16      /* keys that also get their own delay */
+#define UINPUT_DEVS     3       /* virtual devices, one per class */
+#define UINPUT_KBD      0
+#define UINPUT_PAD      1
+#define UINPUT_MOUSE    2
+#define REP_DELAY_MS    250     /* HOLD_KEYS default repeat delay */
+#define REP_PERIOD_MS   33      /* HOLD_KEYS default repeat period */
+
 int init_uinput(void);
+int uinput_device(const char *cls, const char *name, int vendor, int product);
 int close_uinput(void);
 int send_gpio_keys(int grp, int gpio);
+int send_gpio_state(int grp, int gpio, int value);
+void uinput_hold(int delay, int period);
+int uinput_holding(void);
 int sendKey(int key, int value);
+int sendRelAxis(int code, int value);
+void uinput_use_rel(int code);
+int uinput_post(struct input_event *ev, int n, unsigned long long t);
+int sendSync(void);
+int uinput_flush(void);
+void uinput_sleep(int us);
+void uinput_stamp(unsigned long long t);
+int uinput_lat_key(int code);
+int uinput_key_latency(int code, unsigned long *n, unsigned long long *sum, unsigned *max);
+int sendAbs(int code, int value);
+void uinput_use_key(int code);
+void uinput_use_abs(int code, int min, int max, int fuzz, int flat);
 
 #endif
@@ -0,0 +1,208 @@
+/**** uring.c ******************************/
+/*   Universal RPi GPIO keyboard daemon    */
+/*                                         */
+/* io_uring submission                     */
+/*******************************************/
+
+/*
+   This file is part of the Universal Raspberry Pi GPIO keyboard daemon.
+
+   This is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   The software is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with the GNU C Library; if not, write to the Free
+   Software Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+   02111-1307 USA.  
+*/
+
+
+
+/* A minimal io_uring, set up with the raw system calls so no library is
+ * needed.  Requests are queued with uring_write()/uring_timeout(), sent
+ * and waited for with a single uring_enter() and their completions are
+ * handed to one callback by uring_reap().  Only built with URING=yes
+ * (needs a 5.6 or later kernel), a single thread may use it.
+ */
+
+#ifdef USE_URING
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include "uring.h"
+
+static int ring_fd = -1;
+static unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+static unsigned *cq_head, *cq_tail, *cq_mask;
+static unsigned sq_entries;
+static struct io_uring_sqe *sqes;
+static struct io_uring_cqe *cqes;
+static unsigned sq_local;               /* our tail, published by uring_enter() */
+static unsigned sq_sent;                /* tail the kernel was last given */
+static struct __kernel_timespec timer_ts;
+
+
+int uring_init(unsigned entries) {
+
+  struct io_uring_params p;
+  size_t sq_len, cq_len;
+  char *sq_ptr, *cq_ptr;
+
+  memset(&p, 0, sizeof(p));
+  ring_fd = syscall(__NR_io_uring_setup, entries, &p);
+  if (ring_fd < 0) {
+    return(-1);
+  }
+
+  sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  if ((p.features & IORING_FEAT_SINGLE_MMAP) && (cq_len > sq_len)) {
+    sq_len = cq_len;
+  }
+
+  sq_ptr = mmap(NULL, sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                ring_fd, IORING_OFF_SQ_RING);
+  if (sq_ptr == MAP_FAILED) {
+    goto fail;
+  }
+  if (p.features & IORING_FEAT_SINGLE_MMAP) {
+    cq_ptr = sq_ptr;
+  }
+  else {
+    cq_ptr = mmap(NULL, cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                  ring_fd, IORING_OFF_CQ_RING);
+    if (cq_ptr == MAP_FAILED) {
+      goto fail;
+    }
+  }
+  sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+              MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+  if (sqes == MAP_FAILED) {
+    goto fail;
+  }
+
+  sq_head = (unsigned *) (sq_ptr + p.sq_off.head);
+  sq_tail = (unsigned *) (sq_ptr + p.sq_off.tail);
+  sq_mask = (unsigned *) (sq_ptr + p.sq_off.ring_mask);
+  sq_array = (unsigned *) (sq_ptr + p.sq_off.array);
+  cq_head = (unsigned *) (cq_ptr + p.cq_off.head);
+  cq_tail = (unsigned *) (cq_ptr + p.cq_off.tail);
+  cq_mask = (unsigned *) (cq_ptr + p.cq_off.ring_mask);
+  cqes = (struct io_uring_cqe *) (cq_ptr + p.cq_off.cqes);
+  sq_entries = p.sq_entries;
+  sq_local = sq_sent = *sq_tail;
+
+  return(0);
+
+ fail:
+  close(ring_fd);
+  ring_fd = -1;
+  return(-1);
+}
+
+
+static struct io_uring_sqe *get_sqe(void) {
+
+  struct io_uring_sqe *sqe;
+  unsigned idx;
+
+  __sync_synchronize();
+  if (sq_local - *sq_head >= sq_entries) {
+    return(NULL);
+  }
+  idx = sq_local & *sq_mask;
+  sq_array[idx] = idx;
+  sq_local++;
+
+  sqe = &sqes[idx];
+  memset(sqe, 0, sizeof(struct io_uring_sqe));
+  return(sqe);
+}
+
+
+int uring_write(int fd, const void *buf, unsigned len, unsigned long long data) {
+
+  struct io_uring_sqe *sqe;
+
+  if (!(sqe = get_sqe())) {
+    return(-1);
+  }
+  sqe->opcode = IORING_OP_WRITE;
+  sqe->fd = fd;
+  sqe->addr = (unsigned long) buf;
+  sqe->len = len;
+  sqe->off = (unsigned long long) -1;   /* current position, not a pwrite */
+  sqe->user_data = data;
+
+  return(0);
+}
+
+
+/* one timer at a time, it completes with -ETIME */
+int uring_timeout(unsigned us, unsigned long long data) {
+
+  struct io_uring_sqe *sqe;
+
+  if (!(sqe = get_sqe())) {
+    return(-1);
+  }
+  timer_ts.tv_sec = us / 1000000;
+  timer_ts.tv_nsec = (us % 1000000) * 1000;
+  sqe->opcode = IORING_OP_TIMEOUT;
+  sqe->fd = -1;
+  sqe->addr = (unsigned long) &timer_ts;
+  sqe->len = 1;
+  sqe->user_data = data;
+
+  return(0);
+}
+
+
+/* submit what was queued and wait for "wait" completions */
+int uring_enter(unsigned wait) {
+
+  unsigned n;
+  int r;
+
+  __sync_synchronize();
+  *sq_tail = sq_local;
+  __sync_synchronize();
+
+  n = sq_local - sq_sent;
+  r = syscall(__NR_io_uring_enter, ring_fd, n, wait,
+              wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+  if (r > 0) {
+    sq_sent += r;
+  }
+  return(r);
+}
+
+
+void uring_reap(void (*done)(unsigned long long data, int res)) {
+
+  struct io_uring_cqe *cqe;
+  unsigned head;
+
+  head = *cq_head;
+  __sync_synchronize();
+  while (head != *cq_tail) {
+    cqe = &cqes[head & *cq_mask];
+    done(cqe->user_data, cqe->res);
+    head++;
+  }
+  __sync_synchronize();
+  *cq_head = head;
+}
+
+#endif
@@ -0,0 +1,39 @@
+/**** uring.h ******************************/
+/*   Universal RPi GPIO keyboard daemon    */
+/*                                         */
+/* io_uring submission                     */
+/*******************************************/
+
+/*
+   This file is part of the Universal Raspberry Pi GPIO keyboard daemon.
+
+   This is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   The software is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with the GNU C Library; if not, write to the Free
+   Software Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+   02111-1307 USA.  
+*/
+
+
+
+#ifndef _URING_H_
+#define _URING_H_
+
+#define URING_ENTRIES   16
+
+int uring_init(unsigned entries);
+int uring_write(int fd, const void *buf, unsigned len, unsigned long long data);
+int uring_timeout(unsigned us, unsigned long long data);
+int uring_enter(unsigned wait);
+void uring_reap(void (*done)(unsigned long long data, int res));
+
+#endif
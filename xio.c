@@ -0,0 +1,333 @@
+/**** xio.c ********************************/
+/*   Universal RPi GPIO keyboard daemon    */
+/*                                         */
+/* I/O expander driver table               */
+/*******************************************/
+
+/*
+   This file is part of the Universal Raspberry Pi GPIO keyboard daemon.
+
+   This is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   The software is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with the GNU C Library; if not, write to the Free
+   Software Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+   02111-1307 USA.  
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include "xio.h"
+#include "iic.h"
+#include "debug.h"
+
+static int mcp_init(xio_dev_s *dev);
+static int mcp_read(xio_dev_s *dev, int *value);
+static int mcp_capture(xio_dev_s *dev, int *cap, int *value);
+static int pcf_init(xio_dev_s *dev);
+static int pcf_read(xio_dev_s *dev, int *value);
+static int pcf_capture(xio_dev_s *dev, int *cap, int *value);
+static int tca_init(xio_dev_s *dev);
+static int tca_read(xio_dev_s *dev, int *value);
+static int tca_capture(xio_dev_s *dev, int *cap, int *value);
+static int mpr_init(xio_dev_s *dev);
+static int mpr_read(xio_dev_s *dev, int *value);
+static int mpr_capture(xio_dev_s *dev, int *cap, int *value);
+
+static const xio_drv_s xio_drv[] = {
+  { "MCP23008",  IO_MCP23008,  8,  0x00, 0, 4, mcp_init, mcp_read, mcp_capture },
+  { "MCP23017A", IO_MCP23017A, 8,  0x00, 0, 4, mcp_init, mcp_read, mcp_capture },
+  { "MCP23017B", IO_MCP23017B, 8,  0x10, 0, 4, mcp_init, mcp_read, mcp_capture },
+  { "PCF8574",   IO_PCF8574,   8,  0x00, 0, 2, pcf_init, pcf_read, pcf_capture },
+  { "PCF8575",   IO_PCF8575,   16, 0x00, 0, 3, pcf_init, pcf_read, pcf_capture },
+  { "TCA9555",   IO_TCA9555,   16, 0x00, 0, 3, tca_init, tca_read, tca_capture },
+  { "MCP23S08",  IO_MCP23S08,  8,  0x00, 1, 3, mcp_init, mcp_read, mcp_capture },
+  { "MCP23S17A", IO_MCP23S17A, 8,  0x00, 1, 3, mcp_init, mcp_read, mcp_capture },
+  { "MCP23S17B", IO_MCP23S17B, 8,  0x10, 1, 3, mcp_init, mcp_read, mcp_capture },
+  { "MPR121",    IO_MPR121,    12, 0x00, 0, 5, mpr_init, mpr_read, mpr_capture },
+  { NULL,        IO_UNK,       0,  0x00, 0, 0, NULL,     NULL,     NULL },
+};
+
+
+const xio_drv_s *xio_find_driver(const char *name)
+{
+  int i;
+
+  for(i=0; xio_drv[i].name; i++){
+    if( !strcmp(xio_drv[i].name, name) ){
+      return &xio_drv[i];
+    }
+  }
+  return NULL;
+}
+
+const xio_drv_s *xio_driver(iodev_e type)
+{
+  int i;
+
+  for(i=0; xio_drv[i].name; i++){
+    if( xio_drv[i].type == type ){
+      return &xio_drv[i];
+    }
+  }
+  return NULL;
+}
+
+/**
+ ** MCP23008 / MCP23017 and the SPI MCP23S08 / MCP23S17
+ **
+ ** The MCP23017 runs with IOCON.BANK set so both ports have the MCP23008
+ ** register layout, port B starting at 0x10.  The SPI chips only decode
+ ** their address pins once IOCON.HAEN is set; until then they all answer
+ ** to address 0, so the first IOCON write there reaches every chip on the
+ ** chip select.
+ **/
+
+#define MCP_INTCAP 0x08
+#define MCP_GPIO   0x09
+#define MCP_IOCON  0x84                 /* BANK, open drain INT */
+#define MCP_HAEN   0x08                 /* hardware address enable (SPI) */
+
+static int mcp_init(xio_dev_s *dev)
+{
+  const xio_drv_s *drv = xio_driver(dev->type);
+  char iocon = MCP_IOCON | (drv->spi ? MCP_HAEN : 0);
+  char cfg_dat[]={
+    0xff, //IODIR
+    0x00, //IPOL
+    dev->inmask,  //GPINTEN - enable interrupts for defined pins
+    0x00, //DEFVAL
+    0x00, //INTCON - monitor changes
+    iocon, //IOCON - interrupt pin is open collector;
+    0xff, //GPPU - enable all pull-ups
+    0x00, //INTF - read only
+    0x00, //INTCAP - read only
+    0x00, //GPIO
+    0x00, //OLAT - reset if it was written with IOCON before
+  };
+  char buf[]={iocon};
+  int n = 7;
+
+  if(drv->spi){
+    /* IOCON is at 0x0a (MCP23S17 power on) and 0x05 (MCP23S08) */
+    write_iic(dev->bus, 0, (dev->type == IO_MCP23S08) ? 0x05 : 0x0a, buf, 1);
+  }
+
+  if( (dev->type != IO_MCP23008) && (dev->type != IO_MCP23S08) ){
+    /* first ensure that the bank bit is set, on a chip already in bank
+     * mode this hits OLATA which the config burst then clears */
+    if( write_iic(dev->bus, dev->addr, 0x0a, buf, 1) < 0 ){
+      perror("iic init write 1\n");
+    }
+    n = sizeof(cfg_dat);
+  }
+
+  if (debug_on()) {
+    printf("Configuring %s\n", drv->name);
+  }
+  return write_iic(dev->bus, dev->addr, drv->base, cfg_dat, n);
+}
+
+static int mcp_read(xio_dev_s *dev, int *value)
+{
+  char buf[1];
+
+  if( read_iic(dev->bus, dev->addr, xio_driver(dev->type)->base + MCP_GPIO, buf, 1) != 1 ){
+    return -1;
+  }
+  *value = (unsigned char)buf[0];
+  return 0;
+}
+
+/* INTCAP and GPIO are adjacent, one burst gets both and clears the interrupt */
+static int mcp_capture(xio_dev_s *dev, int *cap, int *value)
+{
+  char buf[2];
+
+  if( read_iic(dev->bus, dev->addr, xio_driver(dev->type)->base + MCP_INTCAP, buf, 2) != 2 ){
+    return -1;
+  }
+  *cap = (unsigned char)buf[0];
+  *value = (unsigned char)buf[1];
+  return 0;
+}
+
+/**
+ ** PCF8574 / PCF8575
+ **
+ ** Quasi-bidirectional ports with no registers at all: writing ones makes the
+ ** pins inputs and a plain read returns them, which also clears the interrupt.
+ **/
+
+static int pcf_init(xio_dev_s *dev)
+{
+  char buf[]={0xff, 0xff};
+
+  return write_iic(dev->bus, dev->addr, -1, buf, xio_driver(dev->type)->width / 8);
+}
+
+static int pcf_read(xio_dev_s *dev, int *value)
+{
+  char buf[2];
+  int n = xio_driver(dev->type)->width / 8;
+
+  if( read_iic(dev->bus, dev->addr, -1, buf, n) != n ){
+    return -1;
+  }
+  *value = (unsigned char)buf[0];
+  if(n == 2){
+    *value |= (unsigned char)buf[1] << 8;
+  }
+  return 0;
+}
+
+static int pcf_capture(xio_dev_s *dev, int *cap, int *value)
+{
+  int r;
+
+  r = pcf_read(dev, value);
+  *cap = *value;
+  return r;
+}
+
+/**
+ ** TCA9555
+ **
+ ** The command byte is kept between transfers and a two byte read toggles
+ ** back to the first register of the pair, so once the pointer is on the
+ ** input port every later read can skip it.
+ **/
+
+#define TCA_INPUT    0x00
+#define TCA_POLARITY 0x04
+#define TCA_CONFIG   0x06
+
+static int tca_init(xio_dev_s *dev)
+{
+  char pol[]={0x00, 0x00};
+  char cfg[]={0xff, 0xff};
+
+  dev->regptr = -1;
+  if( write_iic(dev->bus, dev->addr, TCA_POLARITY, pol, 2) < 0 ){
+    return -1;
+  }
+  return write_iic(dev->bus, dev->addr, TCA_CONFIG, cfg, 2);
+}
+
+static int tca_read(xio_dev_s *dev, int *value)
+{
+  char buf[2];
+
+  if( read_iic(dev->bus, dev->addr, (dev->regptr == TCA_INPUT) ? -1 : TCA_INPUT, buf, 2) != 2 ){
+    dev->regptr = -1;
+    return -1;
+  }
+  dev->regptr = TCA_INPUT;
+  *value = (unsigned char)buf[0] | ((unsigned char)buf[1] << 8);
+  return 0;
+}
+
+static int tca_capture(xio_dev_s *dev, int *cap, int *value)
+{
+  int r;
+
+  r = tca_read(dev, value);
+  *cap = *value;
+  return r;
+}
+
+/**
+ ** MPR121
+ **
+ ** Capacitive touch controller with 12 electrodes.  The whole setup from the
+ ** baseline filters through the thresholds, debounce and AFE settings to the
+ ** electrode config is one register run, written as a single burst after a
+ ** soft reset with ECR last so the chip starts running on the final byte.
+ ** IRQ goes low on any touch change and a read of the status pair clears it.
+ ** A touched electrode reads as a 1 and is inverted to look like a pressed
+ ** button.
+ **/
+
+#define MPR_STATUS   0x00
+#define MPR_MHDR     0x2b               /* first baseline filter register */
+#define MPR_TOUCHTH  0x41               /* touch/release pairs per electrode */
+#define MPR_DEBOUNCE 0x5b
+#define MPR_CONFIG1  0x5c
+#define MPR_CONFIG2  0x5d
+#define MPR_ECR      0x5e
+#define MPR_SRST     0x80
+#define MPR_OVCF     0x80               /* over current, chip has stopped */
+#define MPR_TOUCH    12                 /* default thresholds */
+#define MPR_RELEASE  6
+
+static int mpr_init(xio_dev_s *dev)
+{
+  /* rising, falling and touched baseline filters, proximity left as is */
+  static const char filter[]={
+    0x01, 0x01, 0x0e, 0x00,     /* MHDR NHDR NCLR FDLR */
+    0x01, 0x05, 0x01, 0x00,     /* MHDF NHDF NCLF FDLF */
+    0x00, 0x00, 0x00,           /* NHDT NCLT FDLT */
+  };
+  char cfg[MPR_ECR - MPR_MHDR + 1];
+  char reset[]={0x63};
+  int touch = dev->touch ? dev->touch : MPR_TOUCH;
+  int release = dev->release ? dev->release : MPR_RELEASE;
+  int i, ele = 0;
+
+  if( write_iic(dev->bus, dev->addr, MPR_SRST, reset, 1) < 0 ){
+    return -1;
+  }
+
+  memset(cfg, 0, sizeof(cfg));
+  memcpy(cfg, filter, sizeof(filter));
+  for( i=0; i<12; i++ ){
+    cfg[MPR_TOUCHTH - MPR_MHDR + 2*i] = touch;
+    cfg[MPR_TOUCHTH - MPR_MHDR + 2*i + 1] = release;
+    if( dev->inmask & (1 << i) ){
+      ele = i + 1;
+    }
+  }
+  cfg[MPR_DEBOUNCE - MPR_MHDR] = ((dev->debounce & 7) << 4) | (dev->debounce & 7);
+  cfg[MPR_CONFIG1 - MPR_MHDR] = 0x10;   /* 6 samples, 16uA */
+  cfg[MPR_CONFIG2 - MPR_MHDR] = 0x20;   /* 0.5us, 4 samples, 1ms period */
+
+  /* baseline tracking on, electrodes up to the highest one used */
+  cfg[MPR_ECR - MPR_MHDR] = 0x80 | (ele ? ele : 12);
+
+  if (debug_on()) {
+    printf("Configuring MPR121, %d electrodes, thresholds %d/%d\n", ele ? ele : 12, touch, release);
+  }
+  return write_iic(dev->bus, dev->addr, MPR_MHDR, cfg, sizeof(cfg));
+}
+
+static int mpr_read(xio_dev_s *dev, int *value)
+{
+  char buf[2];
+
+  if( read_iic(dev->bus, dev->addr, MPR_STATUS, buf, 2) != 2 ){
+    return -1;
+  }
+  /* treated as a bus fault so the device is set up again */
+  if( buf[1] & MPR_OVCF ){
+    return -1;
+  }
+  *value = ~((unsigned char)buf[0] | (((unsigned char)buf[1] & 0x0f) << 8)) & 0xfff;
+  return 0;
+}
+
+static int mpr_capture(xio_dev_s *dev, int *cap, int *value)
+{
+  int r;
+
+  r = mpr_read(dev, value);
+  *cap = *value;
+  return r;
+}
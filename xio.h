@@ -0,0 +1,53 @@
+/**** xio.h ********************************/
+/*   Universal RPi GPIO keyboard daemon    */
+/*                                         */
+/* I/O expander driver table               */
+/*******************************************/
+
+/*
+   This file is part of the Universal Raspberry Pi GPIO keyboard daemon.
+
+   This is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   The software is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with the GNU C Library; if not, write to the Free
+   Software Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+   02111-1307 USA.  
+*/
+
+#ifndef _XIO_H_
+#define _XIO_H_
+
+#include "config.h"
+
+/* Each expander type supplies its own operations:
+ *   init     - configure all pins as inputs (and interrupts if it has them)
+ *   read     - cheapest read of the current input state
+ *   capture  - service an interrupt; "cap" is the state latched when the
+ *              interrupt fired (same as "value" for chips without a latch)
+ * All return a negative value on a bus error.
+ */
+typedef struct{
+  const char *name;               /* expander id used in pikeyd.conf */
+  iodev_e type;
+  int width;                      /* number of input pins */
+  int base;                       /* register bank offset */
+  int spi;                        /* chip sits on a spidev bus */
+  int cost;                       /* bytes on the bus for one read() */
+  int (*init)(xio_dev_s *dev);
+  int (*read)(xio_dev_s *dev, int *value);
+  int (*capture)(xio_dev_s *dev, int *cap, int *value);
+}xio_drv_s;
+
+const xio_drv_s *xio_find_driver(const char *name);
+const xio_drv_s *xio_driver(iodev_e type);
+
+#endif